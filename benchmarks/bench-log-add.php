@@ -0,0 +1,61 @@
+<?php
+
+// Measure the cost of adding a sample to an ExcimerLog as the log grows.
+//
+// A fixed amount of work is run repeatedly with the profiler running. The
+// time taken by the same work without the profiler is subtracted, and the
+// difference is divided by the number of samples added to the log during
+// the block. The cost per sample should be roughly constant across all
+// blocks, and the memory used by the log per sample should stay bounded.
+
+$blocks = (int)( $argv[1] ?? 20 );
+$work = (int)( $argv[2] ?? 2000000 );
+$period = (float)( $argv[3] ?? 1e-5 );
+
+function recurse( $depth, $callback ) {
+	if ( $depth > 0 ) {
+		recurse( $depth - 1, $callback );
+	} else {
+		$callback();
+	}
+}
+
+function work( $n ) {
+	$x = 0;
+	for ( $i = 0; $i < $n; $i++ ) {
+		$x += $i;
+	}
+	return $x;
+}
+
+recurse( 20, static function () use ( $blocks, $work, $period ) {
+	// Baseline: the best of a few runs without the profiler
+	$baseline = INF;
+	for ( $i = 0; $i < 3; $i++ ) {
+		$t = hrtime( true );
+		work( $work );
+		$baseline = min( $baseline, hrtime( true ) - $t );
+	}
+
+	$profiler = new ExcimerProfiler;
+	$profiler->setPeriod( $period );
+	$log = $profiler->getLog();
+	$startMem = memory_get_usage();
+	$profiler->start();
+	print "size\tns/sample\tbytes/sample\n";
+	for ( $i = 0; $i < $blocks; $i++ ) {
+		$count = count( $log );
+		$t = hrtime( true );
+		work( $work );
+		$t = hrtime( true ) - $t;
+		$added = count( $log ) - $count;
+		if ( $added <= 0 ) {
+			print "No samples were taken, increase the work or reduce the period\n";
+			break;
+		}
+		print count( $log ) . "\t" .
+			round( max( 0, $t - $baseline ) / $added ) . "\t" .
+			round( ( memory_get_usage() - $startMem ) / count( $log ) ) . "\n";
+	}
+	$profiler->stop();
+} );
@@ -41,6 +41,14 @@ if test "$PHP_EXCIMER" != "no"; then
     PHP_EVAL_LIBLINE($LIBS, EXCIMER_SHARED_LIBADD)
   ])
 
+  dnl zlib is optional, it is used to compress pprof output
+  AC_CHECK_HEADER([zlib.h], [
+    PHP_CHECK_LIBRARY(z, deflateInit2_, [
+      PHP_ADD_LIBRARY(z, 1, EXCIMER_SHARED_LIBADD)
+      AC_DEFINE(HAVE_EXCIMER_ZLIB, 1, [Whether zlib is available for compressing pprof output])
+    ])
+  ])
+
   dnl Avoid exporting symbols unnecessarily
   AX_CHECK_COMPILE_FLAG([-fvisibility=hidden],
     [CFLAGS="$CFLAGS -fvisibility=hidden"])
@@ -46,6 +46,9 @@
 
 #define EXCIMER_OBJ_ZP(type, zval_ptr) EXCIMER_OBJ(type, Z_OBJ_P(zval_ptr))
 
+/* Get an ExcimerLog_obj from a zval, syncing it if it is a view */
+#define EXCIMER_LOG_OBJ_ZP(zval_ptr) ExcimerLog_fetch(Z_OBJ_P(zval_ptr))
+
 #define EXCIMER_NEW_OBJECT(type, ce) \
 	excimer_object_alloc_init(sizeof(type ## _obj), &type ## _handlers, ce)
 
@@ -114,6 +117,12 @@ typedef struct {
 
 	/** The current index, for key() etc. */
 	zend_long iter_entry_index;
+
+	/**
+	 * If this is a view created by slice(), the ExcimerLog which owns the
+	 * log data, otherwise null
+	 */
+	zval z_parent;
 	zend_object std;
 } ExcimerLog_obj;
 
@@ -127,8 +136,13 @@ typedef struct {
 	 */
 	zval z_log;
 
-	/** The index of this entry in the ExcimerLog */
-	zend_long index;
+	/**
+	 * The absolute index of this entry in the ExcimerLog, which is the
+	 * index plus the number of entries that had been removed from the start
+	 * of the log when this object was created. See
+	 * excimer_log_get_entries_base().
+	 */
+	uint64_t seq;
 	zend_object std;
 } ExcimerLogEntry_obj;
 
@@ -169,6 +183,10 @@ static void ExcimerProfiler_dtor(zend_object *object);
 static PHP_METHOD(ExcimerProfiler, setPeriod);
 static PHP_METHOD(ExcimerProfiler, setEventType);
 static PHP_METHOD(ExcimerProfiler, setMaxDepth);
+static PHP_METHOD(ExcimerProfiler, reserve);
+static PHP_METHOD(ExcimerProfiler, setRingBuffer);
+static PHP_METHOD(ExcimerProfiler, setAggregateMode);
+static PHP_METHOD(ExcimerProfiler, setRunLengthEncoding);
 static PHP_METHOD(ExcimerProfiler, setFlushCallback);
 static PHP_METHOD(ExcimerProfiler, clearFlushCallback);
 static PHP_METHOD(ExcimerProfiler, start);
@@ -199,7 +217,29 @@ static void ExcimerLog_iterator_invalidate_current(zend_object_iterator *iter);
 static PHP_METHOD(ExcimerLog, __construct);
 static PHP_METHOD(ExcimerLog, formatCollapsed);
 static PHP_METHOD(ExcimerLog, getSpeedscopeData);
+static PHP_METHOD(ExcimerLog, formatSpeedscope);
+static PHP_METHOD(ExcimerLog, formatPprof);
+static PHP_METHOD(ExcimerLog, formatCallgrind);
+static PHP_METHOD(ExcimerLog, formatChromeTrace);
+static PHP_METHOD(ExcimerLog, formatSpeedscopeEvented);
+static PHP_METHOD(ExcimerLog, formatGeckoProfile);
+static PHP_METHOD(ExcimerLog, renderFlameGraph);
+static PHP_METHOD(ExcimerLog, writeFlameGraph);
+static PHP_METHOD(ExcimerLog, writeCollapsed);
+static PHP_METHOD(ExcimerLog, writeSpeedscope);
+static PHP_METHOD(ExcimerLog, writePprof);
+static PHP_METHOD(ExcimerLog, writeCallgrind);
+static PHP_METHOD(ExcimerLog, writeChromeTrace);
+static PHP_METHOD(ExcimerLog, writeSpeedscopeEvented);
+static PHP_METHOD(ExcimerLog, writeGeckoProfile);
 static PHP_METHOD(ExcimerLog, aggregateByFunction);
+static PHP_METHOD(ExcimerLog, aggregateByLine);
+static PHP_METHOD(ExcimerLog, getCallTree);
+static PHP_METHOD(ExcimerLog, getBottomUpTree);
+static PHP_METHOD(ExcimerLog, getCallers);
+static PHP_METHOD(ExcimerLog, getCallees);
+static PHP_METHOD(ExcimerLog, slice);
+static PHP_METHOD(ExcimerLog, diff);
 static PHP_METHOD(ExcimerLog, getEventCount);
 static PHP_METHOD(ExcimerLog, current);
 static PHP_METHOD(ExcimerLog, key);
@@ -217,6 +257,8 @@ static void ExcimerLogEntry_free_object(zend_object *object);
 
 static PHP_METHOD(ExcimerLogEntry, __construct);
 static PHP_METHOD(ExcimerLogEntry, getTimestamp);
+static PHP_METHOD(ExcimerLogEntry, getEndTimestamp);
+static PHP_METHOD(ExcimerLogEntry, getSampleCount);
 static PHP_METHOD(ExcimerLogEntry, getEventCount);
 static PHP_METHOD(ExcimerLogEntry, getTrace);
 
@@ -266,6 +308,23 @@ ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setMaxDepth, 0)
 	ZEND_ARG_INFO(0, max_depth)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_reserve, 0)
+	ZEND_ARG_INFO(0, samples)
+	ZEND_ARG_INFO(0, frames)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setRingBuffer, 0)
+	ZEND_ARG_INFO(0, capacity)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setAggregateMode, 0)
+	ZEND_ARG_INFO(0, aggregate)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setRunLengthEncoding, 0)
+	ZEND_ARG_INFO(0, enable)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerProfiler_setFlushCallback, 0)
 	ZEND_ARG_INFO(0, callback)
 	ZEND_ARG_INFO(0, max_samples)
@@ -293,10 +352,68 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog___construct, 0)
 ZEND_END_ARG_INFO()
 
-ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatCollapsed, 0)
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ExcimerLog_formatCollapsed, 0, 0, 0)
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ExcimerLog_getSpeedscopeData, 0, 0, 0)
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatSpeedscope, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatPprof, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatCallgrind, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatChromeTrace, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatSpeedscopeEvented, 0)
 ZEND_END_ARG_INFO()
 
-ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_getSpeedscopeData, 0)
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_formatGeckoProfile, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ExcimerLog_renderFlameGraph, 0, 0, 0)
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ExcimerLog_writeFlameGraph, 0, 0, 1)
+	ZEND_ARG_INFO(0, stream)
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ExcimerLog_writeCollapsed, 0, 0, 1)
+	ZEND_ARG_INFO(0, stream)
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_writeSpeedscope, 0)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_writePprof, 0)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_writeCallgrind, 0)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_writeChromeTrace, 0)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_writeSpeedscopeEvented, 0)
+	ZEND_ARG_INFO(0, stream)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_writeGeckoProfile, 0)
+	ZEND_ARG_INFO(0, stream)
 ZEND_END_ARG_INFO()
 
 #if PHP_VERSION_ID < 70200
@@ -304,6 +421,56 @@ ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO(arginfo_ExcimerLog_aggregateByFunction, IS_
 #else
 ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO(arginfo_ExcimerLog_aggregateByFunction, IS_ARRAY, 0)
 #endif
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+#if PHP_VERSION_ID < 70200
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO(arginfo_ExcimerLog_aggregateByLine, IS_ARRAY, NULL, 0)
+#else
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO(arginfo_ExcimerLog_aggregateByLine, IS_ARRAY, 0)
+#endif
+ZEND_END_ARG_INFO()
+
+#if PHP_VERSION_ID < 70200
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO(arginfo_ExcimerLog_getCallTree, IS_ARRAY, NULL, 0)
+#else
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO(arginfo_ExcimerLog_getCallTree, IS_ARRAY, 0)
+#endif
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+#if PHP_VERSION_ID < 70200
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO(arginfo_ExcimerLog_getBottomUpTree, IS_ARRAY, NULL, 0)
+#else
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO(arginfo_ExcimerLog_getBottomUpTree, IS_ARRAY, 0)
+#endif
+	ZEND_ARG_INFO(0, options)
+ZEND_END_ARG_INFO()
+
+#if PHP_VERSION_ID < 70200
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_ExcimerLog_getCallers, 0, 1, IS_ARRAY, NULL, 0)
+#else
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_ExcimerLog_getCallers, 0, 1, IS_ARRAY, 0)
+#endif
+	ZEND_ARG_INFO(0, function)
+ZEND_END_ARG_INFO()
+
+#if PHP_VERSION_ID < 70200
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_ExcimerLog_getCallees, 0, 1, IS_ARRAY, NULL, 0)
+#else
+ZEND_BEGIN_ARG_WITH_RETURN_TYPE_INFO_EX(arginfo_ExcimerLog_getCallees, 0, 1, IS_ARRAY, 0)
+#endif
+	ZEND_ARG_INFO(0, function)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_slice, 0)
+	ZEND_ARG_INFO(0, start)
+	ZEND_ARG_INFO(0, end)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO_EX(arginfo_ExcimerLog_diff, 0, 0, 1)
+	ZEND_ARG_INFO(0, baseline)
+	ZEND_ARG_INFO(0, options)
 ZEND_END_ARG_INFO()
 
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLog_getEventCount, 0)
@@ -350,6 +517,12 @@ ZEND_END_ARG_INFO()
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLogEntry_getTimestamp, 0)
 ZEND_END_ARG_INFO()
 
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLogEntry_getEndTimestamp, 0)
+ZEND_END_ARG_INFO()
+
+ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLogEntry_getSampleCount, 0)
+ZEND_END_ARG_INFO()
+
 ZEND_BEGIN_ARG_INFO(arginfo_ExcimerLogEntry_getEventCount, 0)
 ZEND_END_ARG_INFO()
 
@@ -393,6 +566,10 @@ static const zend_function_entry ExcimerProfiler_methods[] = {
 	PHP_ME(ExcimerProfiler, setPeriod, arginfo_ExcimerProfiler_setPeriod, 0)
 	PHP_ME(ExcimerProfiler, setEventType, arginfo_ExcimerProfiler_setEventType, 0)
 	PHP_ME(ExcimerProfiler, setMaxDepth, arginfo_ExcimerProfiler_setMaxDepth, 0)
+	PHP_ME(ExcimerProfiler, reserve, arginfo_ExcimerProfiler_reserve, 0)
+	PHP_ME(ExcimerProfiler, setRingBuffer, arginfo_ExcimerProfiler_setRingBuffer, 0)
+	PHP_ME(ExcimerProfiler, setAggregateMode, arginfo_ExcimerProfiler_setAggregateMode, 0)
+	PHP_ME(ExcimerProfiler, setRunLengthEncoding, arginfo_ExcimerProfiler_setRunLengthEncoding, 0)
 	PHP_ME(ExcimerProfiler, setFlushCallback, arginfo_ExcimerProfiler_setFlushCallback, 0)
 	PHP_ME(ExcimerProfiler, clearFlushCallback, arginfo_ExcimerProfiler_clearFlushCallback, 0)
 	PHP_ME(ExcimerProfiler, start, arginfo_ExcimerProfiler_start, 0)
@@ -407,7 +584,29 @@ static const zend_function_entry ExcimerLog_methods[] = {
 		ZEND_ACC_PRIVATE | ZEND_ACC_FINAL)
 	PHP_ME(ExcimerLog, formatCollapsed, arginfo_ExcimerLog_formatCollapsed, 0)
 	PHP_ME(ExcimerLog, getSpeedscopeData, arginfo_ExcimerLog_getSpeedscopeData, 0)
+	PHP_ME(ExcimerLog, formatSpeedscope, arginfo_ExcimerLog_formatSpeedscope, 0)
+	PHP_ME(ExcimerLog, formatPprof, arginfo_ExcimerLog_formatPprof, 0)
+	PHP_ME(ExcimerLog, formatCallgrind, arginfo_ExcimerLog_formatCallgrind, 0)
+	PHP_ME(ExcimerLog, formatChromeTrace, arginfo_ExcimerLog_formatChromeTrace, 0)
+	PHP_ME(ExcimerLog, formatSpeedscopeEvented, arginfo_ExcimerLog_formatSpeedscopeEvented, 0)
+	PHP_ME(ExcimerLog, formatGeckoProfile, arginfo_ExcimerLog_formatGeckoProfile, 0)
+	PHP_ME(ExcimerLog, renderFlameGraph, arginfo_ExcimerLog_renderFlameGraph, 0)
+	PHP_ME(ExcimerLog, writeFlameGraph, arginfo_ExcimerLog_writeFlameGraph, 0)
+	PHP_ME(ExcimerLog, writeCollapsed, arginfo_ExcimerLog_writeCollapsed, 0)
+	PHP_ME(ExcimerLog, writeSpeedscope, arginfo_ExcimerLog_writeSpeedscope, 0)
+	PHP_ME(ExcimerLog, writePprof, arginfo_ExcimerLog_writePprof, 0)
+	PHP_ME(ExcimerLog, writeCallgrind, arginfo_ExcimerLog_writeCallgrind, 0)
+	PHP_ME(ExcimerLog, writeChromeTrace, arginfo_ExcimerLog_writeChromeTrace, 0)
+	PHP_ME(ExcimerLog, writeSpeedscopeEvented, arginfo_ExcimerLog_writeSpeedscopeEvented, 0)
+	PHP_ME(ExcimerLog, writeGeckoProfile, arginfo_ExcimerLog_writeGeckoProfile, 0)
 	PHP_ME(ExcimerLog, aggregateByFunction, arginfo_ExcimerLog_aggregateByFunction, 0)
+	PHP_ME(ExcimerLog, aggregateByLine, arginfo_ExcimerLog_aggregateByLine, 0)
+	PHP_ME(ExcimerLog, getCallTree, arginfo_ExcimerLog_getCallTree, 0)
+	PHP_ME(ExcimerLog, getBottomUpTree, arginfo_ExcimerLog_getBottomUpTree, 0)
+	PHP_ME(ExcimerLog, getCallers, arginfo_ExcimerLog_getCallers, 0)
+	PHP_ME(ExcimerLog, getCallees, arginfo_ExcimerLog_getCallees, 0)
+	PHP_ME(ExcimerLog, slice, arginfo_ExcimerLog_slice, 0)
+	PHP_ME(ExcimerLog, diff, arginfo_ExcimerLog_diff, 0)
 	PHP_ME(ExcimerLog, getEventCount, arginfo_ExcimerLog_getEventCount, 0)
 	PHP_ME(ExcimerLog, current, arginfo_ExcimerLog_current, 0)
 	PHP_ME(ExcimerLog, key, arginfo_ExcimerLog_key, 0)
@@ -436,6 +635,8 @@ static const zend_function_entry ExcimerLogEntry_methods[] = {
 	PHP_ME(ExcimerLogEntry, __construct, arginfo_ExcimerLogEntry___construct,
 		ZEND_ACC_PRIVATE | ZEND_ACC_FINAL)
 	PHP_ME(ExcimerLogEntry, getTimestamp, arginfo_ExcimerLogEntry_getTimestamp, 0)
+	PHP_ME(ExcimerLogEntry, getEndTimestamp, arginfo_ExcimerLogEntry_getEndTimestamp, 0)
+	PHP_ME(ExcimerLogEntry, getSampleCount, arginfo_ExcimerLogEntry_getSampleCount, 0)
 	PHP_ME(ExcimerLogEntry, getEventCount, arginfo_ExcimerLogEntry_getEventCount, 0)
 	PHP_ME(ExcimerLogEntry, getTrace, arginfo_ExcimerLogEntry_getTrace, 0)
 	PHP_FE_END
@@ -629,7 +830,7 @@ static void ExcimerProfiler_dtor(zend_object *object) /* {{{ */
 	ExcimerLog_obj *log_obj = EXCIMER_OBJ_Z(ExcimerLog, profiler->z_log);
 	zval z_old_log;
 
-	if (log_obj->log.entries_size) {
+	if (excimer_log_get_sample_count(&log_obj->log)) {
 		ExcimerProfiler_flush(profiler, &z_old_log);
 		zval_ptr_dtor(&z_old_log);
 	}
@@ -695,6 +896,81 @@ static PHP_METHOD(ExcimerProfiler, setMaxDepth)
 }
 /* }}} */
 
+/* {{{ proto void ExcimerProfiler::reserve(int samples, int frames)
+ */
+static PHP_METHOD(ExcimerProfiler, reserve)
+{
+	zend_long samples, frames;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+
+	ZEND_PARSE_PARAMETERS_START(2, 2)
+		Z_PARAM_LONG(samples)
+		Z_PARAM_LONG(frames)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (samples < 0 || frames < 0) {
+		php_error_docref(NULL, E_WARNING, "Invalid reservation size");
+		return;
+	}
+
+	excimer_log_reserve(&log_obj->log, samples, frames);
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setRingBuffer(int capacity)
+ */
+static PHP_METHOD(ExcimerProfiler, setRingBuffer)
+{
+	zend_long capacity;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_LONG(capacity)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (capacity < 0) {
+		php_error_docref(NULL, E_WARNING, "Invalid ring buffer capacity");
+		return;
+	}
+
+	excimer_log_set_ring_capacity(&log_obj->log, capacity);
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setAggregateMode(bool aggregate)
+ */
+static PHP_METHOD(ExcimerProfiler, setAggregateMode)
+{
+	zend_bool aggregate;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL(aggregate)
+	ZEND_PARSE_PARAMETERS_END();
+
+	excimer_log_set_aggregate(&log_obj->log, aggregate);
+}
+/* }}} */
+
+/* {{{ proto void ExcimerProfiler::setRunLengthEncoding(bool enable)
+ */
+static PHP_METHOD(ExcimerProfiler, setRunLengthEncoding)
+{
+	zend_bool enable;
+	ExcimerProfiler_obj *profiler = EXCIMER_OBJ_ZP(ExcimerProfiler, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &profiler->z_log);
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_BOOL(enable)
+	ZEND_PARSE_PARAMETERS_END();
+
+	excimer_log_set_merge_runs(&log_obj->log, enable);
+}
+/* }}} */
+
 /* {{{ proto void ExcimerProfiler::setFlushCallback(callable callback, mixed max_samples)
  */
 static PHP_METHOD(ExcimerProfiler, setFlushCallback)
@@ -830,7 +1106,9 @@ static void ExcimerProfiler_event(zend_long event_count, void *user_data) /* {{{
 
 	excimer_log_add(log, EG(current_execute_data), event_count, now_ns);
 
-	if (profiler->max_samples && log->entries_size >= profiler->max_samples) {
+	if (profiler->max_samples
+		&& excimer_log_get_sample_count(log) >= profiler->max_samples)
+	{
 		zval z_old_log;
 		ExcimerProfiler_flush(profiler, &z_old_log);
 		zval_ptr_dtor(&z_old_log);
@@ -887,6 +1165,7 @@ static zend_object *ExcimerLog_new(zend_class_entry *ce) /* {{{ */
 	excimer_log_init(&log_obj->log);
 	/* Lazy-initialise z_current to minimise circular references */
 	ZVAL_NULL(&log_obj->z_current);
+	ZVAL_NULL(&log_obj->z_parent);
 	log_obj->iter_entry_index = 0;
 	return &log_obj->std;
 }
@@ -897,10 +1176,25 @@ static void ExcimerLog_free_object(zend_object *object) /* {{{ */
 	ExcimerLog_obj *log_obj = EXCIMER_OBJ(ExcimerLog, object);
 	excimer_log_destroy(&log_obj->log);
 	zval_ptr_dtor(&log_obj->z_current);
+	zval_ptr_dtor(&log_obj->z_parent);
 	zend_object_std_dtor(object);
 }
 /* }}} */
 
+/**
+ * Get the ExcimerLog_obj from an object, first bringing it up to date with
+ * its parent if it is a view.
+ */
+static ExcimerLog_obj *ExcimerLog_fetch(zend_object *object) /* {{{ */
+{
+	ExcimerLog_obj *log_obj = EXCIMER_OBJ(ExcimerLog, object);
+	if (log_obj->log.parent) {
+		excimer_log_sync_view(&log_obj->log);
+	}
+	return log_obj;
+}
+/* }}} */
+
 /* {{{ ExcimerLog_get_iterator */
 static zend_object_iterator *ExcimerLog_get_iterator(
 	zend_class_entry *ce, zval *zp_log, int by_ref)
@@ -940,7 +1234,7 @@ static void ExcimerLog_iterator_dtor(zend_object_iterator *iter) /* {{{ */
 static int ExcimerLog_iterator_valid(zend_object_iterator *iter) /* {{{ */
 {
 	ExcimerLog_iterator *iterator = (ExcimerLog_iterator*)iter;
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_Z(ExcimerLog, iterator->intern.it.data);
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(&iterator->intern.it.data);
 
 	if (iterator->index < log_obj->log.entries_size) {
 		return SUCCESS;
@@ -953,7 +1247,7 @@ static int ExcimerLog_iterator_valid(zend_object_iterator *iter) /* {{{ */
 static zval *ExcimerLog_iterator_get_current_data(zend_object_iterator *iter) /* {{{ */
 {
 	ExcimerLog_iterator *iterator = (ExcimerLog_iterator*)iter;
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_Z(ExcimerLog, iterator->intern.it.data);
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(&iterator->intern.it.data);
 
 	if (Z_ISNULL(iterator->z_current)) {
 		if (iterator->index < log_obj->log.entries_size) {
@@ -969,7 +1263,7 @@ static zval *ExcimerLog_iterator_get_current_data(zend_object_iterator *iter) /*
 static void ExcimerLog_iterator_get_current_key(zend_object_iterator *iter, zval *key) /* {{{ */
 {
 	ExcimerLog_iterator *iterator = (ExcimerLog_iterator*)iter;
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_Z(ExcimerLog, iterator->intern.it.data);
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(&iterator->intern.it.data);
 
 	if (iterator->index < log_obj->log.entries_size) {
 		ZVAL_LONG(key, iterator->index);
@@ -982,7 +1276,7 @@ static void ExcimerLog_iterator_get_current_key(zend_object_iterator *iter, zval
 static void ExcimerLog_iterator_move_forward(zend_object_iterator *iter) /* {{{ */
 {
 	ExcimerLog_iterator *iterator = (ExcimerLog_iterator*)iter;
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_Z(ExcimerLog, iterator->intern.it.data);
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(&iterator->intern.it.data);
 
 	zval_ptr_dtor(&iterator->z_current);
 	ZVAL_NULL(&iterator->z_current);
@@ -1014,7 +1308,7 @@ static void ExcimerLog_iterator_invalidate_current(zend_object_iterator *iter) /
 
 static void ExcimerLog_init_entry(zval *zp_dest, zval *zp_log, zend_long index) /* {{{ */
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, zp_log);
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(zp_log);
 	excimer_log_entry *entry = excimer_log_get_entry(&log_obj->log, index);
 	ExcimerLogEntry_obj *entry_obj;
 
@@ -1022,7 +1316,7 @@ static void ExcimerLog_init_entry(zval *zp_dest, zval *zp_log, zend_long index)
 		object_init_ex(zp_dest, ExcimerLogEntry_ce);
 		entry_obj = EXCIMER_OBJ_ZP(ExcimerLogEntry, zp_dest);
 		ZVAL_COPY(&entry_obj->z_log, zp_log);
-		entry_obj->index = index;
+		entry_obj->seq = excimer_log_get_entries_base(&log_obj->log) + index;
 	} else {
 		ZVAL_NULL(zp_dest);
 	}
@@ -1032,7 +1326,7 @@ static void ExcimerLog_init_entry(zval *zp_dest, zval *zp_log, zend_long index)
 #if PHP_VERSION_ID < 80000
 static int ExcimerLog_count_elements(zval *zp_log, zend_long *lp_count) /* {{{ */
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, zp_log);
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(zp_log);
 	*lp_count = log_obj->log.entries_size;
 	return SUCCESS;
 }
@@ -1040,7 +1334,7 @@ static int ExcimerLog_count_elements(zval *zp_log, zend_long *lp_count) /* {{{ *
 #else
 static int ExcimerLog_count_elements(zend_object *object, zend_long *lp_count) /* {{{ */
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ(ExcimerLog, object);
+	ExcimerLog_obj *log_obj = ExcimerLog_fetch(object);
 	*lp_count = log_obj->log.entries_size;
 	return SUCCESS;
 }
@@ -1055,30 +1349,562 @@ static PHP_METHOD(ExcimerLog, __construct)
 }
 /* }}} */
 
-/* {{{ proto string ExcimerLog::formatCollapsed()
+/**
+ * Read the minFraction and maxBytes pruning options from an options array,
+ * which may be NULL. Raise a warning and return FAILURE if they are invalid.
+ */
+static int ExcimerLog_get_prune_options(HashTable *ht_options, /* {{{ */
+	excimer_log_prune_options *options)
+{
+	zval *zp_value;
+	zend_long max_bytes = 0;
+
+	options->min_fraction = 0;
+	options->max_bytes = 0;
+	if (!ht_options) {
+		return SUCCESS;
+	}
+	if ((zp_value = zend_hash_str_find(ht_options, "minFraction", sizeof("minFraction")-1))) {
+		options->min_fraction = zval_get_double(zp_value);
+	}
+	if ((zp_value = zend_hash_str_find(ht_options, "maxBytes", sizeof("maxBytes")-1))) {
+		max_bytes = zval_get_long(zp_value);
+	}
+	if (!(options->min_fraction >= 0 && options->min_fraction <= 1) || max_bytes < 0) {
+		php_error_docref(NULL, E_WARNING, "Invalid pruning options");
+		return FAILURE;
+	}
+	options->max_bytes = (size_t)max_bytes;
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ proto string ExcimerLog::formatCollapsed(array options = [])
  */
 static PHP_METHOD(ExcimerLog, formatCollapsed)
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
-	RETURN_STR(excimer_log_format_collapsed(&log_obj->log));
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	HashTable *ht_options = NULL;
+	excimer_log_prune_options options;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(ht_options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (ExcimerLog_get_prune_options(ht_options, &options) == FAILURE) {
+		return;
+	}
+	RETURN_STR(excimer_log_format_collapsed(&log_obj->log, &options));
 }
 /* }}} */
 
-/* {{{ proto string ExcimerLog::getSpeedscopeData()
+/* {{{ proto array ExcimerLog::getSpeedscopeData(array options = [])
  */
 static PHP_METHOD(ExcimerLog, getSpeedscopeData)
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
-	excimer_log_get_speedscope_data(&log_obj->log, return_value);
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	HashTable *ht_options = NULL;
+	excimer_log_prune_options options;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(ht_options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (ExcimerLog_get_prune_options(ht_options, &options) == FAILURE) {
+		return;
+	}
+	excimer_log_get_speedscope_data(&log_obj->log, &options, return_value);
 }
 /* }}} */
 
-/* {{{ proto string ExcimerLog::aggregateByFunction()
+/* {{{ proto string ExcimerLog::formatSpeedscope()
+ */
+static PHP_METHOD(ExcimerLog, formatSpeedscope)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	RETURN_STR(excimer_log_format_speedscope(&log_obj->log));
+}
+/* }}} */
+
+/**
+ * Get the Unix time in nanoseconds corresponding to the log epoch. The epoch
+ * is measured with the monotonic clock, so it is converted using the
+ * current time on both clocks.
+ */
+static uint64_t ExcimerLog_get_unix_epoch(ExcimerLog_obj *log_obj) /* {{{ */
+{
+	struct timespec now_ts, unix_ts;
+
+	timerlib_clock_get_time(TIMERLIB_REAL, &now_ts);
+	clock_gettime(CLOCK_REALTIME, &unix_ts);
+	return timerlib_timespec_to_ns(&unix_ts)
+		- (timerlib_timespec_to_ns(&now_ts) - log_obj->log.epoch);
+}
+/* }}} */
+
+/* {{{ proto string ExcimerLog::formatPprof()
+ */
+static PHP_METHOD(ExcimerLog, formatPprof)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	RETURN_STR(excimer_log_format_pprof(&log_obj->log,
+		ExcimerLog_get_unix_epoch(log_obj)));
+}
+/* }}} */
+
+/* {{{ proto string ExcimerLog::formatCallgrind()
+ */
+static PHP_METHOD(ExcimerLog, formatCallgrind)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	RETURN_STR(excimer_log_format_callgrind(&log_obj->log));
+}
+/* }}} */
+
+/* {{{ proto string ExcimerLog::formatChromeTrace()
+ */
+static PHP_METHOD(ExcimerLog, formatChromeTrace)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	RETURN_STR(excimer_log_format_chrome_trace(&log_obj->log));
+}
+/* }}} */
+
+/* {{{ proto string ExcimerLog::formatSpeedscopeEvented()
+ */
+static PHP_METHOD(ExcimerLog, formatSpeedscopeEvented)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	RETURN_STR(excimer_log_format_speedscope_evented(&log_obj->log));
+}
+/* }}} */
+
+/* {{{ proto string ExcimerLog::formatGeckoProfile()
+ */
+static PHP_METHOD(ExcimerLog, formatGeckoProfile)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	RETURN_STR(excimer_log_format_gecko(&log_obj->log,
+		ExcimerLog_get_unix_epoch(log_obj)));
+}
+/* }}} */
+
+static int ExcimerLog_get_flame_graph_options(HashTable *ht_options, /* {{{ */
+	excimer_log_flame_graph_options *options)
+{
+	zval *zp_value;
+
+	options->width = 1200;
+	options->min_width = 0.1;
+	options->title = NULL;
+	if (ht_options) {
+		if ((zp_value = zend_hash_str_find(ht_options, "width", sizeof("width")-1))) {
+			options->width = zval_get_long(zp_value);
+		}
+		if ((zp_value = zend_hash_str_find(ht_options, "minWidth", sizeof("minWidth")-1))) {
+			options->min_width = zval_get_double(zp_value);
+		}
+	}
+	if (options->width <= 0 || options->min_width < 0) {
+		php_error_docref(NULL, E_WARNING, "Invalid flame graph dimensions");
+		return FAILURE;
+	}
+	if (ht_options) {
+		if ((zp_value = zend_hash_str_find(ht_options, "title", sizeof("title")-1))) {
+			options->title = zval_get_string(zp_value);
+		}
+	}
+	return SUCCESS;
+}
+/* }}} */
+
+/* {{{ proto string ExcimerLog::renderFlameGraph(array options = [])
+ */
+static PHP_METHOD(ExcimerLog, renderFlameGraph)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	HashTable *ht_options = NULL;
+	excimer_log_flame_graph_options options;
+	zend_string *result;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(ht_options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (ExcimerLog_get_flame_graph_options(ht_options, &options) == FAILURE) {
+		return;
+	}
+	result = excimer_log_format_flame_graph(&log_obj->log, &options);
+	if (options.title) {
+		zend_string_release(options.title);
+	}
+	RETURN_STR(result);
+}
+/* }}} */
+
+/* {{{ proto bool ExcimerLog::writeFlameGraph(resource stream, array options = [])
+ */
+static PHP_METHOD(ExcimerLog, writeFlameGraph)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zval *zp_stream;
+	php_stream *stream;
+	HashTable *ht_options = NULL;
+	excimer_log_flame_graph_options options;
+	int result;
+
+	ZEND_PARSE_PARAMETERS_START(1, 2)
+		Z_PARAM_RESOURCE(zp_stream)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(ht_options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	php_stream_from_zval(stream, zp_stream);
+	if (ExcimerLog_get_flame_graph_options(ht_options, &options) == FAILURE) {
+		return;
+	}
+	result = excimer_log_write_flame_graph(&log_obj->log, &options, stream);
+	if (options.title) {
+		zend_string_release(options.title);
+	}
+	RETURN_BOOL(result);
+}
+/* }}} */
+
+/* {{{ proto bool ExcimerLog::writeCollapsed(resource stream, array options = [])
+ */
+static PHP_METHOD(ExcimerLog, writeCollapsed)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zval *zp_stream;
+	php_stream *stream;
+	HashTable *ht_options = NULL;
+	excimer_log_prune_options options;
+
+	ZEND_PARSE_PARAMETERS_START(1, 2)
+		Z_PARAM_RESOURCE(zp_stream)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(ht_options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	php_stream_from_zval(stream, zp_stream);
+	if (ExcimerLog_get_prune_options(ht_options, &options) == FAILURE) {
+		return;
+	}
+	RETURN_BOOL(excimer_log_write_collapsed(&log_obj->log, &options, stream));
+}
+/* }}} */
+
+/* {{{ proto bool ExcimerLog::writeSpeedscope(resource stream)
+ */
+static PHP_METHOD(ExcimerLog, writeSpeedscope)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zval *zp_stream;
+	php_stream *stream;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_RESOURCE(zp_stream)
+	ZEND_PARSE_PARAMETERS_END();
+
+	php_stream_from_zval(stream, zp_stream);
+	RETURN_BOOL(excimer_log_write_speedscope(&log_obj->log, stream));
+}
+/* }}} */
+
+/* {{{ proto bool ExcimerLog::writePprof(resource stream)
+ */
+static PHP_METHOD(ExcimerLog, writePprof)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zval *zp_stream;
+	php_stream *stream;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_RESOURCE(zp_stream)
+	ZEND_PARSE_PARAMETERS_END();
+
+	php_stream_from_zval(stream, zp_stream);
+	RETURN_BOOL(excimer_log_write_pprof(&log_obj->log,
+		ExcimerLog_get_unix_epoch(log_obj), stream));
+}
+/* }}} */
+
+/* {{{ proto bool ExcimerLog::writeCallgrind(resource stream)
+ */
+static PHP_METHOD(ExcimerLog, writeCallgrind)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zval *zp_stream;
+	php_stream *stream;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_RESOURCE(zp_stream)
+	ZEND_PARSE_PARAMETERS_END();
+
+	php_stream_from_zval(stream, zp_stream);
+	RETURN_BOOL(excimer_log_write_callgrind(&log_obj->log, stream));
+}
+/* }}} */
+
+/* {{{ proto bool ExcimerLog::writeChromeTrace(resource stream)
+ */
+static PHP_METHOD(ExcimerLog, writeChromeTrace)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zval *zp_stream;
+	php_stream *stream;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_RESOURCE(zp_stream)
+	ZEND_PARSE_PARAMETERS_END();
+
+	php_stream_from_zval(stream, zp_stream);
+	RETURN_BOOL(excimer_log_write_chrome_trace(&log_obj->log, stream));
+}
+/* }}} */
+
+/* {{{ proto bool ExcimerLog::writeSpeedscopeEvented(resource stream)
+ */
+static PHP_METHOD(ExcimerLog, writeSpeedscopeEvented)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zval *zp_stream;
+	php_stream *stream;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_RESOURCE(zp_stream)
+	ZEND_PARSE_PARAMETERS_END();
+
+	php_stream_from_zval(stream, zp_stream);
+	RETURN_BOOL(excimer_log_write_speedscope_evented(&log_obj->log, stream));
+}
+/* }}} */
+
+/* {{{ proto bool ExcimerLog::writeGeckoProfile(resource stream)
+ */
+static PHP_METHOD(ExcimerLog, writeGeckoProfile)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zval *zp_stream;
+	php_stream *stream;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_RESOURCE(zp_stream)
+	ZEND_PARSE_PARAMETERS_END();
+
+	php_stream_from_zval(stream, zp_stream);
+	RETURN_BOOL(excimer_log_write_gecko(&log_obj->log,
+		ExcimerLog_get_unix_epoch(log_obj), stream));
+}
+/* }}} */
+
+/* {{{ proto array ExcimerLog::aggregateByFunction(array options = [])
  */
 static PHP_METHOD(ExcimerLog, aggregateByFunction)
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
-	RETURN_ARR(excimer_log_aggr_by_func(&log_obj->log));
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	HashTable *ht_options = NULL;
+	excimer_log_prune_options options;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(ht_options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (ExcimerLog_get_prune_options(ht_options, &options) == FAILURE) {
+		/* The return type is array */
+		array_init(return_value);
+		return;
+	}
+	RETURN_ARR(excimer_log_aggr_by_func(&log_obj->log, &options));
+}
+/* }}} */
+
+/* {{{ proto array ExcimerLog::aggregateByLine()
+ */
+static PHP_METHOD(ExcimerLog, aggregateByLine)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	RETURN_ARR(excimer_log_aggr_by_line(&log_obj->log));
+}
+/* }}} */
+
+/* {{{ proto array ExcimerLog::getCallTree(array options = [])
+ */
+static PHP_METHOD(ExcimerLog, getCallTree)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	HashTable *ht_options = NULL;
+	zend_long min_weight = 0;
+	zval *zp_value;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(ht_options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (ht_options
+		&& (zp_value = zend_hash_str_find(ht_options, "minWeight", sizeof("minWeight")-1)))
+	{
+		min_weight = zval_get_long(zp_value);
+	}
+	RETURN_ARR(excimer_log_get_call_tree(&log_obj->log, min_weight));
+}
+/* }}} */
+
+/* {{{ proto array ExcimerLog::getBottomUpTree(array options = [])
+ */
+static PHP_METHOD(ExcimerLog, getBottomUpTree)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	HashTable *ht_options = NULL;
+	zend_long min_weight = 0;
+	zval *zp_value;
+
+	ZEND_PARSE_PARAMETERS_START(0, 1)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(ht_options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	if (ht_options
+		&& (zp_value = zend_hash_str_find(ht_options, "minWeight", sizeof("minWeight")-1)))
+	{
+		min_weight = zval_get_long(zp_value);
+	}
+	RETURN_ARR(excimer_log_get_bottom_up_tree(&log_obj->log, min_weight));
+}
+/* }}} */
+
+/* {{{ proto array ExcimerLog::getCallers(string function)
+ */
+static PHP_METHOD(ExcimerLog, getCallers)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zend_string *function_name;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_STR(function_name)
+	ZEND_PARSE_PARAMETERS_END();
+
+	RETURN_ARR(excimer_log_get_callers(&log_obj->log, function_name));
+}
+/* }}} */
+
+/* {{{ proto array ExcimerLog::getCallees(string function)
+ */
+static PHP_METHOD(ExcimerLog, getCallees)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	zend_string *function_name;
+
+	ZEND_PARSE_PARAMETERS_START(1, 1)
+		Z_PARAM_STR(function_name)
+	ZEND_PARSE_PARAMETERS_END();
+
+	RETURN_ARR(excimer_log_get_callees(&log_obj->log, function_name));
+}
+/* }}} */
+
+/**
+ * Convert a time in seconds relative to the log epoch, as returned by
+ * ExcimerLogEntry::getTimestamp(), to a log timestamp in nanoseconds
+ */
+static uint64_t ExcimerLog_seconds_to_timestamp(excimer_log *log, double seconds) /* {{{ */
+{
+	double ns = (double)log->epoch + seconds * 1e9;
+	if (!(ns > 0)) {
+		return 0;
+	} else if (ns >= 18446744073709551615.0) {
+		return UINT64_MAX;
+	} else {
+		return (uint64_t)ns;
+	}
+}
+/* }}} */
+
+/* {{{ proto ExcimerLog ExcimerLog::slice(float start, float end)
+ */
+static PHP_METHOD(ExcimerLog, slice)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	ExcimerLog_obj *view_obj;
+	double start, end;
+
+	ZEND_PARSE_PARAMETERS_START(2, 2)
+		Z_PARAM_DOUBLE(start)
+		Z_PARAM_DOUBLE(end)
+	ZEND_PARSE_PARAMETERS_END();
+
+	/* Aggregated samples have no timestamp, so they cannot be sliced */
+	if (log_obj->log.aggregate || log_obj->log.aggregated_samples) {
+		php_error_docref(NULL, E_WARNING, "Cannot slice a log with aggregated samples");
+		return;
+	}
+
+	object_init_ex(return_value, ExcimerLog_ce);
+	view_obj = EXCIMER_OBJ_ZP(ExcimerLog, return_value);
+
+	/* Hold a reference to the object which owns the data, not to an
+	 * intermediate view */
+	if (Z_TYPE(log_obj->z_parent) == IS_OBJECT) {
+		ZVAL_COPY(&view_obj->z_parent, &log_obj->z_parent);
+	} else {
+		ZVAL_COPY(&view_obj->z_parent, getThis());
+	}
+
+	excimer_log_slice(&view_obj->log, &log_obj->log,
+		ExcimerLog_seconds_to_timestamp(&log_obj->log, start),
+		ExcimerLog_seconds_to_timestamp(&log_obj->log, end));
+}
+/* }}} */
+
+/* {{{ proto mixed ExcimerLog::diff(ExcimerLog baseline, array options = [])
+ */
+static PHP_METHOD(ExcimerLog, diff)
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
+	ExcimerLog_obj *baseline_obj;
+	zval *zp_baseline;
+	HashTable *ht_options = NULL;
+	zval *zp_value;
+	int normalize = 1;
+	int by_function = 0;
+
+	ZEND_PARSE_PARAMETERS_START(1, 2)
+		Z_PARAM_OBJECT_OF_CLASS(zp_baseline, ExcimerLog_ce)
+		Z_PARAM_OPTIONAL
+		Z_PARAM_ARRAY_HT(ht_options)
+	ZEND_PARSE_PARAMETERS_END();
+
+	baseline_obj = EXCIMER_LOG_OBJ_ZP(zp_baseline);
+
+	if (ht_options) {
+		if ((zp_value = zend_hash_str_find(ht_options, "format", sizeof("format")-1))) {
+			zend_string *format = zval_get_string(zp_value);
+			if (zend_string_equals_literal(format, "functions")) {
+				by_function = 1;
+			} else if (!zend_string_equals_literal(format, "collapsed")) {
+				php_error_docref(NULL, E_WARNING, "Invalid diff format");
+				zend_string_release(format);
+				return;
+			}
+			zend_string_release(format);
+		}
+		if ((zp_value = zend_hash_str_find(ht_options, "normalize", sizeof("normalize")-1))) {
+			normalize = zend_is_true(zp_value);
+		}
+	}
+
+	if (by_function) {
+		RETURN_ARR(excimer_log_diff_by_func(&log_obj->log, &baseline_obj->log, normalize));
+	} else {
+		RETURN_STR(excimer_log_format_diff_collapsed(&log_obj->log,
+			&baseline_obj->log, normalize));
+	}
 }
 /* }}} */
 
@@ -1086,7 +1912,7 @@ static PHP_METHOD(ExcimerLog, aggregateByFunction)
  */
 static PHP_METHOD(ExcimerLog, getEventCount)
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
 	RETURN_LONG(log_obj->log.event_count);
 }
 /* }}} */
@@ -1095,7 +1921,7 @@ static PHP_METHOD(ExcimerLog, getEventCount)
  */
 static PHP_METHOD(ExcimerLog, current)
 {
-	ExcimerLog_obj * log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	ExcimerLog_obj * log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
 
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
@@ -1112,7 +1938,7 @@ static PHP_METHOD(ExcimerLog, current)
  */
 static PHP_METHOD(ExcimerLog, key)
 {
-	ExcimerLog_obj * log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	ExcimerLog_obj * log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
 
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
@@ -1129,7 +1955,7 @@ static PHP_METHOD(ExcimerLog, key)
  */
 static PHP_METHOD(ExcimerLog, next)
 {
-	ExcimerLog_obj * log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	ExcimerLog_obj * log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
 
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
@@ -1146,7 +1972,7 @@ static PHP_METHOD(ExcimerLog, next)
  */
 static PHP_METHOD(ExcimerLog, rewind)
 {
-	ExcimerLog_obj * log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	ExcimerLog_obj * log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
 
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
@@ -1161,7 +1987,7 @@ static PHP_METHOD(ExcimerLog, rewind)
  */
 static PHP_METHOD(ExcimerLog, valid)
 {
-	ExcimerLog_obj * log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	ExcimerLog_obj * log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
 
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
@@ -1178,7 +2004,7 @@ static PHP_METHOD(ExcimerLog, valid)
  */
 static PHP_METHOD(ExcimerLog, count)
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
 
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
@@ -1190,7 +2016,7 @@ static PHP_METHOD(ExcimerLog, count)
 /* {{{ proto bool ExcimerLog::offsetExists(mixed offset) */
 static PHP_METHOD(ExcimerLog, offsetExists)
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
 	zend_long offset;
 
 	ZEND_PARSE_PARAMETERS_START(1, 1);
@@ -1208,7 +2034,7 @@ static PHP_METHOD(ExcimerLog, offsetExists)
 /* {{{ proto mixed ExcimerLog::offsetGet(mixed offset) */
 static PHP_METHOD(ExcimerLog, offsetGet)
 {
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, getThis());
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(getThis());
 	zend_long offset;
 
 	ZEND_PARSE_PARAMETERS_START(1, 1);
@@ -1241,7 +2067,7 @@ static zend_object *ExcimerLogEntry_new(zend_class_entry *ce) /* {{{ */
 {
 	ExcimerLogEntry_obj *entry_obj = EXCIMER_NEW_OBJECT(ExcimerLogEntry, ce);
 	ZVAL_NULL(&entry_obj->z_log);
-	entry_obj->index = 0;
+	entry_obj->seq = 0;
 	return &entry_obj->std;
 }
 /* }}} */
@@ -1255,6 +2081,31 @@ static void ExcimerLogEntry_free_object(zend_object *object) /* {{{ */
 }
 /* }}} */
 
+/**
+ * Get the log entry of an ExcimerLogEntry object. If the entry has since
+ * been overwritten in a ring buffer or otherwise removed from the log, throw
+ * an exception and return NULL.
+ */
+static excimer_log_entry *ExcimerLogEntry_get_entry(ExcimerLogEntry_obj *entry_obj,
+	ExcimerLog_obj **log_obj_p) /* {{{ */
+{
+	ExcimerLog_obj *log_obj = EXCIMER_LOG_OBJ_ZP(&entry_obj->z_log);
+	uint64_t base = excimer_log_get_entries_base(&log_obj->log);
+	excimer_log_entry *entry = NULL;
+
+	if (entry_obj->seq >= base && entry_obj->seq - base < log_obj->log.entries_size) {
+		entry = excimer_log_get_entry(&log_obj->log, (zend_long)(entry_obj->seq - base));
+	}
+	if (!entry) {
+		zend_throw_exception(spl_ce_RuntimeException,
+			"The log entry has been removed from the log", 0);
+		return NULL;
+	}
+	*log_obj_p = log_obj;
+	return entry;
+}
+/* }}} */
+
 /* {{{ proto void ExcimerLogEntry::__construct()
  */
 static PHP_METHOD(ExcimerLogEntry, __construct)
@@ -1268,27 +2119,77 @@ static PHP_METHOD(ExcimerLogEntry, __construct)
 static PHP_METHOD(ExcimerLogEntry, getTimestamp)
 {
 	ExcimerLogEntry_obj *entry_obj = EXCIMER_OBJ_ZP(ExcimerLogEntry, getThis());
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &entry_obj->z_log);
-	excimer_log_entry *entry = excimer_log_get_entry(&log_obj->log, entry_obj->index);
+	ExcimerLog_obj *log_obj;
+	excimer_log_entry *entry;
 
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
 
+	entry = ExcimerLogEntry_get_entry(entry_obj, &log_obj);
+	if (!entry) {
+		return;
+	}
+
 	RETURN_DOUBLE((entry->timestamp - log_obj->log.epoch) / 1e9);
 }
 /* }}} */
 
+/* {{{ proto float ExcimerLogEntry::getEndTimestamp()
+ */
+static PHP_METHOD(ExcimerLogEntry, getEndTimestamp)
+{
+	ExcimerLogEntry_obj *entry_obj = EXCIMER_OBJ_ZP(ExcimerLogEntry, getThis());
+	ExcimerLog_obj *log_obj;
+	excimer_log_entry *entry;
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	entry = ExcimerLogEntry_get_entry(entry_obj, &log_obj);
+	if (!entry) {
+		return;
+	}
+
+	RETURN_DOUBLE((entry->end_timestamp - log_obj->log.epoch) / 1e9);
+}
+/* }}} */
+
+/* {{{ proto int ExcimerLogEntry::getSampleCount()
+ */
+static PHP_METHOD(ExcimerLogEntry, getSampleCount)
+{
+	ExcimerLogEntry_obj *entry_obj = EXCIMER_OBJ_ZP(ExcimerLogEntry, getThis());
+	ExcimerLog_obj *log_obj;
+	excimer_log_entry *entry;
+
+	ZEND_PARSE_PARAMETERS_START(0, 0);
+	ZEND_PARSE_PARAMETERS_END();
+
+	entry = ExcimerLogEntry_get_entry(entry_obj, &log_obj);
+	if (!entry) {
+		return;
+	}
+
+	RETURN_LONG(entry->sample_count);
+}
+/* }}} */
+
 /* {{{ proto float ExcimerLogEntry::getEventCount()
  */
 static PHP_METHOD(ExcimerLogEntry, getEventCount)
 {
 	ExcimerLogEntry_obj *entry_obj = EXCIMER_OBJ_ZP(ExcimerLogEntry, getThis());
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &entry_obj->z_log);
-	excimer_log_entry *entry = excimer_log_get_entry(&log_obj->log, entry_obj->index);
+	ExcimerLog_obj *log_obj;
+	excimer_log_entry *entry;
 
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
 
+	entry = ExcimerLogEntry_get_entry(entry_obj, &log_obj);
+	if (!entry) {
+		return;
+	}
+
 	RETURN_LONG(entry->event_count);
 }
 /* }}} */
@@ -1298,12 +2199,17 @@ static PHP_METHOD(ExcimerLogEntry, getEventCount)
 static PHP_METHOD(ExcimerLogEntry, getTrace)
 {
 	ExcimerLogEntry_obj *entry_obj = EXCIMER_OBJ_ZP(ExcimerLogEntry, getThis());
-	ExcimerLog_obj *log_obj = EXCIMER_OBJ_ZP(ExcimerLog, &entry_obj->z_log);
-	excimer_log_entry *entry = excimer_log_get_entry(&log_obj->log, entry_obj->index);
+	ExcimerLog_obj *log_obj;
+	excimer_log_entry *entry;
 
 	ZEND_PARSE_PARAMETERS_START(0, 0);
 	ZEND_PARSE_PARAMETERS_END();
 
+	entry = ExcimerLogEntry_get_entry(entry_obj, &log_obj);
+	if (!entry) {
+		return;
+	}
+
 	RETURN_ARR(excimer_log_trace_to_array(&log_obj->log, entry->frame_index));
 }
 /* }}} */
@@ -13,16 +13,38 @@
  * limitations under the License.
  */
 
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_EXCIMER_ZLIB
+#include <zlib.h>
+#endif
+
 #include "php.h"
 #include "Zend/zend_smart_str.h"
+#include "Zend/zend_sort.h"
 #include "php_excimer.h"
 #include "excimer_log.h"
 
 static const char excimer_log_truncated_name[] = "excimer_truncated";
+static const char excimer_log_pruned_name[] = "excimer_pruned";
 static const char excimer_log_fake_filename[] = "excimer fake file";
 
+/** The initial number of elements allocated when an array is first grown */
+#define EXCIMER_LOG_MIN_CAPACITY 16
+
+/**
+ * The initial size of the frame and function hashtables. This must be a
+ * power of two.
+ */
+#define EXCIMER_LOG_MIN_FRAME_TABLE_SIZE 64
+
+/** The number of elements in the function cache. This must be a power of two. */
+#define EXCIMER_LOG_FUNCTION_CACHE_SIZE 256
+
 static uint32_t excimer_log_find_or_add_frame(excimer_log *log,
-		zend_execute_data *execute_data, zend_long depth);
+		zend_execute_data *execute_data);
 
 /* {{{ Compatibility functions and macros */
 
@@ -90,39 +112,285 @@ static inline void excimer_log_add_assoc_array(zval *dest, const char *key, Hash
 
 /* }}} */
 
+/* {{{ Output buffering */
+
+/**
+ * The amount of buffered output at which it is written to the stream or
+ * compressed
+ */
+#define EXCIMER_LOG_OUTPUT_CHUNK_SIZE 65536
+
+/**
+ * The destination of a formatter: either a string, or a PHP stream to which
+ * output is written in chunks of bounded size, so that the memory usage does
+ * not depend on the output size. The output may optionally be compressed.
+ */
+typedef struct {
+	/** The uncompressed output which has not yet been written */
+	smart_str ss;
+
+	/** The stream, or NULL to produce a string */
+	php_stream *stream;
+
+	/** Compressed output, when producing a compressed string */
+	smart_str compressed;
+
+	/** Non-zero if writing to the stream failed */
+	int failed;
+
+#ifdef HAVE_EXCIMER_ZLIB
+	/** The compressor, or NULL if compression is not enabled */
+	z_stream *zstream;
+#endif
+} excimer_log_output;
+
+static void excimer_log_output_init(excimer_log_output *out, php_stream *stream)
+{
+	memset(out, 0, sizeof(excimer_log_output));
+	out->stream = stream;
+}
+
+/**
+ * Write final output data to the stream or the compressed string
+ */
+static void excimer_log_output_sink(excimer_log_output *out, const char *data, size_t len)
+{
+	if (!len || out->failed) {
+		return;
+	}
+	if (!out->stream) {
+		smart_str_appendl(&out->compressed, data, len);
+	} else if ((size_t)php_stream_write(out->stream, data, len) != len) {
+		out->failed = 1;
+	}
+}
+
+#ifdef HAVE_EXCIMER_ZLIB
+/**
+ * Compress data and pass the result to the sink
+ */
+static void excimer_log_output_deflate(excimer_log_output *out,
+	const char *data, size_t len, int flush)
+{
+	char buf[16384];
+	int status;
+
+	out->zstream->next_in = (Bytef*)data;
+	out->zstream->avail_in = len;
+	do {
+		out->zstream->next_out = (Bytef*)buf;
+		out->zstream->avail_out = sizeof(buf);
+		status = deflate(out->zstream, flush);
+		if (status == Z_STREAM_ERROR) {
+			out->failed = 1;
+			return;
+		}
+		excimer_log_output_sink(out, buf, sizeof(buf) - out->zstream->avail_out);
+	} while (out->zstream->avail_out == 0);
+}
+#endif
+
+/**
+ * Enable gzip compression, if Excimer was compiled with zlib. This must be
+ * called before anything is written.
+ */
+static void excimer_log_output_enable_gzip(excimer_log_output *out)
+{
+#ifdef HAVE_EXCIMER_ZLIB
+	out->zstream = ecalloc(1, sizeof(z_stream));
+	/* 16 + MAX_WBITS selects the gzip wrapper */
+	if (deflateInit2(out->zstream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+		16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		efree(out->zstream);
+		out->zstream = NULL;
+	}
+#endif
+}
+
+/**
+ * Pass the buffered output to the compressor or the sink, and clear the
+ * buffer
+ */
+static void excimer_log_output_flush(excimer_log_output *out, int final)
+{
+	size_t len = excimer_log_smart_str_get_len(&out->ss);
+	const char *data = len ? ZSTR_VAL(out->ss.s) : "";
+
+#ifdef HAVE_EXCIMER_ZLIB
+	if (out->zstream) {
+		excimer_log_output_deflate(out, data, len, final ? Z_FINISH : Z_NO_FLUSH);
+	} else
+#endif
+	{
+		excimer_log_output_sink(out, data, len);
+	}
+	if (out->ss.s) {
+		ZSTR_LEN(out->ss.s) = 0;
+	}
+}
+
+/**
+ * Flush the output if enough of it is buffered. Formatters call this
+ * periodically.
+ */
+static inline void excimer_log_output_check(excimer_log_output *out)
+{
+	if (excimer_log_smart_str_get_len(&out->ss) >= EXCIMER_LOG_OUTPUT_CHUNK_SIZE) {
+#ifdef HAVE_EXCIMER_ZLIB
+		if (out->zstream) {
+			excimer_log_output_flush(out, 0);
+			return;
+		}
+#endif
+		if (out->stream) {
+			excimer_log_output_flush(out, 0);
+		}
+	}
+}
+
+/**
+ * Finish writing to the stream and free the output. Return non-zero on
+ * success.
+ */
+static int excimer_log_output_close(excimer_log_output *out)
+{
+	int compressed = 0;
+
+#ifdef HAVE_EXCIMER_ZLIB
+	compressed = out->zstream != NULL;
+#endif
+	if (out->stream || compressed) {
+		excimer_log_output_flush(out, 1);
+	}
+#ifdef HAVE_EXCIMER_ZLIB
+	if (out->zstream) {
+		deflateEnd(out->zstream);
+		efree(out->zstream);
+	}
+#endif
+	smart_str_free(&out->ss);
+	return !out->failed;
+}
+
+/**
+ * Finish producing a string and free the output
+ */
+static zend_string *excimer_log_output_to_string(excimer_log_output *out)
+{
+#ifdef HAVE_EXCIMER_ZLIB
+	if (out->zstream) {
+		excimer_log_output_close(out);
+		return excimer_log_smart_str_extract(&out->compressed);
+	}
+#endif
+	return excimer_log_smart_str_extract(&out->ss);
+}
+
+/**
+ * Define the public string and stream functions for a formatter
+ */
+#define EXCIMER_LOG_DEFINE_OUTPUTS(name) \
+	zend_string *excimer_log_format_ ## name(excimer_log *log) \
+	{ \
+		excimer_log_output out; \
+		excimer_log_output_init(&out, NULL); \
+		excimer_log_output_ ## name(log, &out); \
+		return excimer_log_output_to_string(&out); \
+	} \
+	int excimer_log_write_ ## name(excimer_log *log, php_stream *stream) \
+	{ \
+		excimer_log_output out; \
+		excimer_log_output_init(&out, stream); \
+		excimer_log_output_ ## name(log, &out); \
+		return excimer_log_output_close(&out); \
+	}
+
+/* }}} */
+
 void excimer_log_init(excimer_log *log)
 {
 	log->entries_size = 0;
+	log->entries_capacity = 0;
+	log->ring_capacity = 0;
+	log->entries_head = 0;
 	log->entries = NULL;
 	log->frames = ecalloc(1, sizeof(excimer_log_frame));
 	log->frames_size = 1;
-	log->reverse_frames = excimer_log_new_array(0);
+	log->frames_capacity = 1;
+	log->functions = ecalloc(1, sizeof(excimer_log_function));
+	log->functions_size = 1;
+	log->functions_capacity = 1;
+	log->owned_strings = NULL;
+	log->owned_strings_size = 0;
+	log->owned_strings_capacity = 0;
+	log->reserved_entries = 0;
+	log->entries_base = 0;
+	log->parent = NULL;
+	log->view_start = 0;
+	log->view_end = 0;
+	log->view_parent_event_count = 0;
+	log->reserved_frames = 0;
+	log->aggregate = 0;
+	log->frame_counts = NULL;
+	log->frame_counts_capacity = 0;
+	log->aggregated_samples = 0;
+	log->merge_runs = 0;
+	log->merged_samples = 0;
+	log->frame_table = ecalloc(EXCIMER_LOG_MIN_FRAME_TABLE_SIZE, sizeof(uint32_t));
+	log->frame_table_mask = EXCIMER_LOG_MIN_FRAME_TABLE_SIZE - 1;
+	log->function_table = ecalloc(EXCIMER_LOG_MIN_FRAME_TABLE_SIZE, sizeof(uint32_t));
+	log->function_table_mask = EXCIMER_LOG_MIN_FRAME_TABLE_SIZE - 1;
+	log->truncated_frame_index = 0;
+	log->function_cache = NULL;
+	log->stack = NULL;
+	log->stack_size = 0;
+	log->stack_capacity = 0;
+	log->stack_base = 0;
+	log->walk_buffer = NULL;
+	log->walk_capacity = 0;
 	log->epoch = 0;
 	log->event_count = 0;
 }
 
 void excimer_log_destroy(excimer_log *log)
 {
+	if (log->parent) {
+		/* The arrays of a view are borrowed from its parent */
+		log->entries = NULL;
+		log->frames = NULL;
+		log->functions = NULL;
+	}
 	if (log->entries) {
 		efree(log->entries);
 	}
 	if (log->frames) {
-		int i;
-		for (i = 0; i < log->frames_size; i++) {
-			if (log->frames[i].filename) {
-				zend_string_delref(log->frames[i].filename);
-			}
-			if (log->frames[i].class_name) {
-				zend_string_delref(log->frames[i].class_name);
-			}
-			if (log->frames[i].function_name) {
-				zend_string_delref(log->frames[i].function_name);
-			}
-		}
 		efree(log->frames);
 	}
-	zend_hash_destroy(log->reverse_frames);
-	efree(log->reverse_frames);
+	if (log->functions) {
+		efree(log->functions);
+	}
+	if (log->owned_strings) {
+		size_t i;
+		for (i = 0; i < log->owned_strings_size; i++) {
+			zend_string_release(log->owned_strings[i]);
+		}
+		efree(log->owned_strings);
+	}
+	efree(log->frame_table);
+	efree(log->function_table);
+	if (log->function_cache) {
+		efree(log->function_cache);
+	}
+	if (log->frame_counts) {
+		efree(log->frame_counts);
+	}
+	if (log->stack) {
+		efree(log->stack);
+	}
+	if (log->walk_buffer) {
+		efree(log->walk_buffer);
+	}
 }
 
 void excimer_log_set_max_depth(excimer_log *log, zend_long depth)
@@ -130,597 +398,3941 @@ void excimer_log_set_max_depth(excimer_log *log, zend_long depth)
 	log->max_depth = depth;
 }
 
-void excimer_log_copy_options(excimer_log *dest, excimer_log  *src)
+/**
+ * Grow an array so that it has space for at least the given number of
+ * elements. The capacity is at least doubled, so that appending an element
+ * takes amortized constant time.
+ */
+static void *excimer_log_grow(void *ptr, size_t *capacity, size_t needed,
+	size_t element_size)
 {
-	dest->max_depth = src->max_depth;
-	dest->epoch = src->epoch;
-	dest->period = src->period;
+	size_t new_capacity;
+
+	if (needed <= *capacity) {
+		return ptr;
+	}
+	new_capacity = *capacity < EXCIMER_LOG_MIN_CAPACITY
+		? EXCIMER_LOG_MIN_CAPACITY : *capacity;
+	while (new_capacity < needed) {
+		if (new_capacity > SIZE_MAX / 2) {
+			new_capacity = needed;
+			break;
+		}
+		new_capacity *= 2;
+	}
+	ptr = safe_erealloc(ptr, new_capacity, element_size, 0);
+	*capacity = new_capacity;
+	return ptr;
 }
 
-void excimer_log_add(excimer_log *log, zend_execute_data *execute_data,
-	zend_long event_count, uint64_t timestamp)
+/**
+ * Append an uninitialised frame to the frames array, and return its index
+ */
+static uint32_t excimer_log_new_frame(excimer_log *log)
 {
-	uint32_t frame_index = excimer_log_find_or_add_frame(log, execute_data, 0);
-	excimer_log_entry *entry;
-
-	log->entries = safe_erealloc(log->entries, log->entries_size + 1,
-		sizeof(excimer_log_entry), 0);
-	entry = &log->entries[log->entries_size++];
-	entry->frame_index = frame_index;
-	entry->event_count = event_count;
-	log->event_count += event_count;
-	entry->timestamp = timestamp;
+	if (log->frames_size >= log->frames_capacity) {
+		log->frames = excimer_log_grow(log->frames, &log->frames_capacity,
+			log->frames_size + 1, sizeof(excimer_log_frame));
+	}
+	return excimer_safe_uint32(log->frames_size++);
 }
 
-static uint32_t excimer_log_get_truncation_marker(excimer_log *log) {
-	zval* zp_index;
-	zval z_new_index;
-	excimer_log_frame *p_frame;
-	
-	zp_index = zend_hash_str_find(log->reverse_frames,
-		excimer_log_truncated_name, sizeof(excimer_log_truncated_name) - 1);
-	if (zp_index) {
-		return excimer_safe_uint32(Z_LVAL_P(zp_index));
+/**
+ * Append an uninitialised function to the functions array, and return its
+ * index
+ */
+static uint32_t excimer_log_new_function(excimer_log *log)
+{
+	if (log->functions_size >= log->functions_capacity) {
+		log->functions = excimer_log_grow(log->functions, &log->functions_capacity,
+			log->functions_size + 1, sizeof(excimer_log_function));
 	}
-
-	ZVAL_LONG(&z_new_index, log->frames_size);
-	zend_hash_str_add(log->reverse_frames,
-		excimer_log_truncated_name, sizeof(excimer_log_truncated_name) - 1,
-		&z_new_index);
-	log->frames = safe_erealloc(log->frames, log->frames_size + 1,
-		sizeof(excimer_log_frame), 0);
-	p_frame = &log->frames[log->frames_size++];
-
-	p_frame->filename = zend_string_init(excimer_log_fake_filename,
-		sizeof(excimer_log_fake_filename) - 1, 0);
-	p_frame->lineno = 1;
-	p_frame->closure_line = 0;
-	p_frame->class_name = NULL;
-	p_frame->function_name = zend_string_init(excimer_log_truncated_name,
-		sizeof(excimer_log_truncated_name) - 1, 0);
-	p_frame->prev_index = 0;
-
-	return excimer_safe_uint32(Z_LVAL(z_new_index));
+	return excimer_safe_uint32(log->functions_size++);
 }
 
-static uint32_t excimer_log_find_or_add_frame(excimer_log *log,
-	zend_execute_data *execute_data, zend_long depth)
+/**
+ * Take ownership of a reference to a non-interned string, which will be
+ * released when the log is destroyed.
+ */
+static void excimer_log_own_string(excimer_log *log, zend_string *str)
 {
-	uint32_t prev_index;
-	if (!execute_data) {
-		return 0;
-	} else if (!execute_data->prev_execute_data) {
-		prev_index = 0;
-	} else if (log->max_depth && depth >= log->max_depth) {
-		prev_index = excimer_log_get_truncation_marker(log);
-	} else {
-		prev_index = excimer_log_find_or_add_frame(log,
-			execute_data->prev_execute_data, depth + 1);
+	if (log->owned_strings_size >= log->owned_strings_capacity) {
+		log->owned_strings = excimer_log_grow(log->owned_strings,
+			&log->owned_strings_capacity, log->owned_strings_size + 1,
+			sizeof(zend_string*));
 	}
-	if (!execute_data->func
-		|| !ZEND_USER_CODE(execute_data->func->common.type))
-	{
-		return prev_index;
-	} else {
-		zend_function *func = execute_data->func;
-		excimer_log_frame frame = {NULL};
-		smart_str ss_key = {NULL};
-		zend_string *str_key;
-		zval* zp_index;
-
-		frame.filename = func->op_array.filename;
-		zend_string_addref(frame.filename);
-
-		if (func->common.scope && func->common.scope->name) {
-			frame.class_name = func->common.scope->name;
-			zend_string_addref(frame.class_name);
-		}
-
-		if (func->common.function_name) {
-			frame.function_name = func->common.function_name;
-			zend_string_addref(frame.function_name);
-		}
+	log->owned_strings[log->owned_strings_size++] = str;
+}
 
-		if (func->op_array.fn_flags & ZEND_ACC_CLOSURE) {
-			frame.closure_line = func->op_array.line_start;
-		}
+/**
+ * Make a string safe to store in the log. Interned strings, which includes
+ * all strings stored by opcache, outlive the log and so are borrowed without
+ * touching the refcount. Other strings, for example from eval()'d code, are
+ * referenced.
+ */
+static zend_string *excimer_log_borrow_string(excimer_log *log, zend_string *str)
+{
+	if (str && !ZSTR_IS_INTERNED(str)) {
+		zend_string_addref(str);
+		excimer_log_own_string(log, str);
+	}
+	return str;
+}
 
-		frame.lineno = execute_data->opline->lineno;
-		frame.prev_index = prev_index;
+static void excimer_log_frame_table_resize(excimer_log *log, size_t min_frames);
 
-		/* Make a key for reverse lookup */
-		smart_str_append(&ss_key, frame.filename);
-		smart_str_appendc(&ss_key, '\0');
-		excimer_log_smart_str_append_printf(&ss_key, "%d", frame.lineno);
-		smart_str_appendc(&ss_key, '\0');
-		excimer_log_smart_str_append_printf(&ss_key, "%d", frame.prev_index);
-		str_key = excimer_log_smart_str_extract(&ss_key);
+void excimer_log_reserve(excimer_log *log, size_t entries, size_t frames)
+{
+	log->reserved_entries = entries;
+	log->reserved_frames = frames;
+	/* A ring buffer is already allocated at its full size */
+	if (!log->ring_capacity && entries > log->entries_capacity) {
+		log->entries = safe_erealloc(log->entries, entries,
+			sizeof(excimer_log_entry), 0);
+		log->entries_capacity = entries;
+	}
+	if (frames > log->frames_capacity) {
+		log->frames = safe_erealloc(log->frames, frames,
+			sizeof(excimer_log_frame), 0);
+		log->frames_capacity = frames;
+		excimer_log_frame_table_resize(log, frames);
+	}
+}
 
-		/* Look for a matching frame in the reverse hashtable */
-		zp_index = zend_hash_find(log->reverse_frames, str_key);
-		if (zp_index) {
-			zend_string_free(str_key);
-			zend_string_delref(frame.filename);
-			if (frame.class_name) {
-				zend_string_delref(frame.class_name);
-			}
-			if (frame.function_name) {
-				zend_string_delref(frame.function_name);
-			}
+void excimer_log_set_ring_capacity(excimer_log *log, size_t capacity)
+{
+	size_t num_kept = log->entries_size;
+	size_t new_capacity = capacity;
+	size_t first = 0;
+	size_t i;
+	excimer_log_entry *new_entries;
 
-			return excimer_safe_uint32(Z_LVAL_P(zp_index));
-		} else {
-			zval z_new_index;
+	if (capacity == log->ring_capacity) {
+		return;
+	}
+	if (capacity && num_kept > capacity) {
+		first = num_kept - capacity;
+		num_kept = capacity;
+	}
+	if (!capacity) {
+		new_capacity = MAX(num_kept, log->entries_capacity);
+	}
 
-			/* Create a new entry in the array and reverse hashtable */
-			ZVAL_LONG(&z_new_index, log->frames_size);
-			zend_hash_add(log->reverse_frames, str_key, &z_new_index);
-			log->frames = safe_erealloc(log->frames, log->frames_size + 1,
-				sizeof(excimer_log_frame), 0);
-			memcpy(&log->frames[log->frames_size++], &frame, sizeof(excimer_log_frame));
+	/* Copy the kept entries to a new array, oldest first */
+	new_entries = new_capacity
+		? safe_emalloc(new_capacity, sizeof(excimer_log_entry), 0) : NULL;
+	for (i = 0; i < first; i++) {
+		excimer_log_entry *entry = excimer_log_get_entry(log, i);
+		log->event_count -= entry->event_count;
+		log->merged_samples -= entry->sample_count - 1;
+	}
+	log->entries_base += first;
+	for (i = 0; i < num_kept; i++) {
+		new_entries[i] = *excimer_log_get_entry(log, first + i);
+	}
 
-			zend_string_delref(str_key);
-			return excimer_safe_uint32(Z_LVAL(z_new_index));
-		}
+	if (log->entries) {
+		efree(log->entries);
 	}
+	log->entries = new_entries;
+	log->entries_size = num_kept;
+	log->entries_capacity = new_capacity;
+	log->entries_head = 0;
+	log->ring_capacity = capacity;
 }
 
-zend_long excimer_log_get_size(excimer_log *log)
+void excimer_log_set_aggregate(excimer_log *log, int aggregate)
 {
-	return log->entries_size;
+	log->aggregate = aggregate;
 }
 
-excimer_log_entry *excimer_log_get_entry(excimer_log *log, zend_long i)
+void excimer_log_set_merge_runs(excimer_log *log, int merge_runs)
 {
-	if (i >= 0 && i < log->entries_size) {
-		return &log->entries[i];
-	} else {
-		return NULL;
-	}
+	log->merge_runs = merge_runs;
 }
 
-excimer_log_frame *excimer_log_get_frame(excimer_log *log, zend_long i)
+void excimer_log_copy_options(excimer_log *dest, excimer_log  *src)
 {
-	if (i > 0 && i < log->frames_size) {
-		return &log->frames[i];
-	} else {
-		return NULL;
+	dest->max_depth = src->max_depth;
+	dest->epoch = src->epoch;
+	dest->period = src->period;
+	dest->aggregate = src->aggregate;
+	dest->merge_runs = src->merge_runs;
+	if (src->ring_capacity) {
+		excimer_log_set_ring_capacity(dest, src->ring_capacity);
 	}
+	excimer_log_reserve(dest, src->reserved_entries, src->reserved_frames);
 }
 
-static void excimer_log_append_no_spaces(smart_str *dest, zend_string *src)
+void excimer_log_add(excimer_log *log, zend_execute_data *execute_data,
+	zend_long event_count, uint64_t timestamp)
 {
-	size_t new_len = smart_str_alloc(dest, ZSTR_LEN(src), 0);
-	size_t prev_len = ZSTR_LEN(dest->s);
-	size_t i;
-	for (i = 0; i < ZSTR_LEN(src); i++) {
-		char c = ZSTR_VAL(src)[i];
-		if (c == ' ' || c == '\0') {
-			c = '_';
+	uint32_t frame_index = excimer_log_find_or_add_frame(log, execute_data);
+	excimer_log_entry *entry;
+
+	if (log->aggregate) {
+		if (frame_index >= log->frame_counts_capacity) {
+			size_t old_capacity = log->frame_counts_capacity;
+			log->frame_counts = excimer_log_grow(log->frame_counts,
+				&log->frame_counts_capacity, log->frames_size, sizeof(zend_long));
+			memset(log->frame_counts + old_capacity, 0,
+				(log->frame_counts_capacity - old_capacity) * sizeof(zend_long));
 		}
-		ZSTR_VAL(dest->s)[prev_len + i] = c;
+		log->frame_counts[frame_index] += event_count;
+		log->event_count += event_count;
+		log->aggregated_samples++;
+		return;
 	}
-	ZSTR_LEN(dest->s) = new_len;
-}
 
-static void excimer_log_append_frame_name(smart_str *ss, excimer_log_frame *frame) {
-	if (frame->closure_line != 0) {
-		/* Annotate anonymous functions with their source location.
-		 * Example: {closure:/path/to/file.php(123)}
-		 */
-		smart_str_appends(ss, "{closure:");
-		excimer_log_append_no_spaces(ss, frame->filename);
-		excimer_log_smart_str_append_printf(ss, "(%d)}", frame->closure_line);
-	} else if (frame->function_name == NULL) {
-		/* For file-scope code, use the file name */
-		excimer_log_append_no_spaces(ss, frame->filename);
+	if (log->merge_runs && log->entries_size) {
+		entry = excimer_log_get_entry(log, log->entries_size - 1);
+		/* Merge only if there was no gap, so that the sample times can be
+		 * interpolated */
+		if (entry->frame_index == frame_index
+			&& entry->sample_count < UINT32_MAX
+			&& (!log->period
+				|| timestamp - entry->end_timestamp <= (uint64_t)(event_count + 1) * log->period))
+		{
+			entry->end_timestamp = timestamp;
+			entry->sample_count++;
+			entry->event_count += event_count;
+			log->event_count += event_count;
+			log->merged_samples++;
+			return;
+		}
+	}
+
+	if (log->ring_capacity && log->entries_size >= log->ring_capacity) {
+		/* Overwrite the oldest entry */
+		entry = &log->entries[log->entries_head];
+		log->event_count -= entry->event_count;
+		log->merged_samples -= entry->sample_count - 1;
+		log->entries_head = (log->entries_head + 1) % log->ring_capacity;
+		log->entries_base++;
 	} else {
-		if (frame->class_name) {
-			excimer_log_append_no_spaces(ss, frame->class_name);
-			smart_str_appends(ss, "::");
+		if (log->entries_size >= log->entries_capacity) {
+			log->entries = excimer_log_grow(log->entries, &log->entries_capacity,
+				log->entries_size + 1, sizeof(excimer_log_entry));
 		}
-		excimer_log_append_no_spaces(ss, frame->function_name);
+		entry = &log->entries[log->entries_size++];
 	}
+	entry->frame_index = frame_index;
+	entry->event_count = event_count;
+	log->event_count += event_count;
+	entry->timestamp = timestamp;
+	entry->end_timestamp = timestamp;
+	entry->sample_count = 1;
 }
 
-zend_string *excimer_log_format_collapsed(excimer_log *log)
+/**
+ * Hash the key of a frame for the frame table.
+ */
+static inline uint32_t excimer_log_frame_hash(uint32_t function_index,
+	uint32_t lineno, uint32_t prev_index)
 {
-	zend_long entry_index;
-	zend_long frame_index;
-	zval *zp_count;
-	zval z_count;
-	smart_str ss_out = {NULL};
-	HashTable frame_counts_storage, lines_storage;
-	HashTable *ht_frame_counts, *ht_lines;
+	uint64_t h = ((uint64_t)lineno << 32 | prev_index) * UINT64_C(0x9e3779b97f4a7c15);
+	h ^= function_index * UINT64_C(0xc2b2ae3d27d4eb4f);
+	h ^= h >> 29;
+	return (uint32_t)h;
+}
 
-	ht_frame_counts = &frame_counts_storage;
-	memset(ht_frame_counts, 0, sizeof(HashTable));
-	zend_hash_init(ht_frame_counts, 0, NULL, NULL, 0);
+/**
+ * Hash the key of a function for the function table.
+ */
+static inline uint32_t excimer_log_function_hash(excimer_log_function *key)
+{
+	uint64_t h = zend_string_hash_val(key->filename);
+	if (key->class_name) {
+		h = h * 31 + zend_string_hash_val(key->class_name);
+	}
+	if (key->function_name) {
+		h = h * 31 + zend_string_hash_val(key->function_name);
+	}
+	h = (h + key->closure_line) * UINT64_C(0x9e3779b97f4a7c15);
+	h ^= h >> 29;
+	return (uint32_t)h;
+}
 
-	ht_lines = &lines_storage;
-	memset(ht_lines, 0, sizeof(HashTable));
-	zend_hash_init(ht_lines, 0, NULL, NULL, 0);
+/**
+ * Compare two strings, either of which may be NULL
+ */
+static inline int excimer_log_string_equals(zend_string *a, zend_string *b)
+{
+	return a == b || (a && b && zend_string_equals(a, b));
+}
 
-	excimer_log_frame ** frame_ptrs = NULL;
-	size_t frames_capacity = 0;
-	zend_string *str_line;
+/**
+ * If a hashtable with the given mask would be more than half full with the
+ * given number of elements, replace it with a larger empty table and return
+ * non-zero. The caller is then responsible for reinserting the elements.
+ */
+static int excimer_log_table_grow(uint32_t **table, uint32_t *mask, size_t min_size)
+{
+	size_t size = (size_t)*mask + 1;
 
-	/* Collate frame counts */
-	for (entry_index = 0; entry_index < log->entries_size; entry_index++) {
-		excimer_log_entry *entry = excimer_log_get_entry(log, entry_index);
-		zp_count = zend_hash_index_find(ht_frame_counts, entry->frame_index);
-		if (!zp_count) {
-			ZVAL_LONG(&z_count, 0);
-			zp_count = zend_hash_index_add(ht_frame_counts, entry->frame_index, &z_count);
+	if (min_size <= size / 2) {
+		return 0;
+	}
+	while (size / 2 < min_size) {
+		if (size > UINT32_MAX / 2) {
+			zend_error_noreturn(E_ERROR, "Too many Excimer frames");
 		}
-
-		Z_LVAL_P(zp_count) += entry->event_count;
+		size *= 2;
 	}
 
-	/* Format traces, and deduplicate frames that differ only in hidden line numbers */
-	ZEND_HASH_FOREACH_NUM_KEY_VAL(ht_frame_counts, frame_index, zp_count) {
-		zend_long current_frame_index = frame_index;
-		zend_long num_frames = 0;
-		excimer_log_frame *frame;
-		zend_long i;
-		int line_start = 1; /* TODO use bool when PHP 7.4 support is dropped */
-		smart_str ss_line = {NULL};
-
-		/* Build the array of frame pointers */
-		while (current_frame_index) {
-			frame = excimer_log_get_frame(log, current_frame_index);
-			if (num_frames >= frames_capacity) {
-				if (frames_capacity >= ZEND_LONG_MAX - 1) {
-					/* Probably unreachable */
-					zend_error_noreturn(E_ERROR, "Too many Excimer frames");
-				}
-				frames_capacity++;
-				frame_ptrs = safe_erealloc(frame_ptrs, frames_capacity, sizeof(*frame_ptrs), 0);
-			}
-			frame_ptrs[num_frames++] = frame;
-			current_frame_index = frame->prev_index;
-		}
+	efree(*table);
+	*table = safe_emalloc(size, sizeof(uint32_t), 0);
+	memset(*table, 0, size * sizeof(uint32_t));
+	*mask = (uint32_t)(size - 1);
+	return 1;
+}
 
-		/* Run through the array in reverse */
-		for (i = num_frames - 1; i >= 0; i--) {
-			frame = frame_ptrs[i];
+/**
+ * Find the slot in the frame table containing the index of the frame with
+ * the given key. If there is no such frame, return the empty slot into which
+ * its index should be inserted.
+ */
+static uint32_t *excimer_log_frame_table_find(excimer_log *log,
+	uint32_t function_index, uint32_t lineno, uint32_t prev_index)
+{
+	uint32_t mask = log->frame_table_mask;
+	uint32_t i = excimer_log_frame_hash(function_index, lineno, prev_index) & mask;
 
-			if (line_start) {
-				line_start = 0;
-			} else {
-				smart_str_appends(&ss_line, ";");
-			}
-			excimer_log_append_frame_name(&ss_line, frame);
-		}
+	while (1) {
+		uint32_t *slot = &log->frame_table[i];
+		excimer_log_frame *frame;
 
-		/* ht_lines[ss_line] += zp_count */
-		str_line = excimer_log_smart_str_extract(&ss_line);
-		zval *zp_line_count = zend_hash_find(ht_lines, str_line);
-		if (!zp_line_count) {
-			ZVAL_LONG(&z_count, 0);
-			zp_line_count = zend_hash_add(ht_lines, str_line, &z_count);
+		if (!*slot) {
+			return slot;
 		}
-		Z_LVAL_P(zp_line_count) += Z_LVAL_P(zp_count);
-	}
-	ZEND_HASH_FOREACH_END();
-
-	/* Concatenate lines */
-	ZEND_HASH_FOREACH_STR_KEY_VAL(ht_lines, str_line, zp_count) {
-		smart_str_append(&ss_out, str_line);
-		excimer_log_smart_str_append_printf(&ss_out, " " ZEND_LONG_FMT "\n", Z_LVAL_P(zp_count));
+		frame = &log->frames[*slot];
+		if (frame->lineno == lineno
+			&& frame->prev_index == prev_index
+			&& frame->function_index == function_index)
+		{
+			return slot;
+		}
+		i = (i + 1) & mask;
 	}
-	ZEND_HASH_FOREACH_END();
-
-	zend_hash_destroy(ht_frame_counts);
-	zend_hash_destroy(ht_lines);
-	efree(frame_ptrs);
-	return excimer_log_smart_str_extract(&ss_out);
 }
 
-static HashTable *excimer_log_frame_to_speedscope_array(excimer_log_frame *frame) {
-	HashTable *ht_func = excimer_log_new_array(0);
-	zval tmp;
-	smart_str ss_name = {NULL};
-	
-	excimer_log_append_frame_name(&ss_name, frame);
-	ZVAL_STR(&tmp, excimer_log_smart_str_extract(&ss_name));
-	zend_hash_str_add(ht_func, "name", sizeof("name")-1, &tmp);
-
-	if (frame->filename) {
-		ZVAL_STR_COPY(&tmp, frame->filename);
+/**
+ * Reallocate the frame table so that it can hold at least the given number
+ * of frames while remaining at most half full, and reinsert the existing
+ * frames.
+ */
+static void excimer_log_frame_table_resize(excimer_log *log, size_t min_frames)
+{
+	uint32_t i;
+
+	if (!excimer_log_table_grow(&log->frame_table, &log->frame_table_mask, min_frames)) {
+		return;
+	}
+	for (i = 1; i < log->frames_size; i++) {
+		excimer_log_frame *frame = &log->frames[i];
+		if (i != log->truncated_frame_index) {
+			*excimer_log_frame_table_find(log, frame->function_index,
+				frame->lineno, frame->prev_index) = i;
+		}
+	}
+}
+
+/**
+ * Find the slot in the function table containing the index of the function
+ * with the given key, or the empty slot into which it should be inserted.
+ */
+static uint32_t *excimer_log_function_table_find(excimer_log *log,
+	excimer_log_function *key)
+{
+	uint32_t mask = log->function_table_mask;
+	uint32_t i = excimer_log_function_hash(key) & mask;
+
+	while (1) {
+		uint32_t *slot = &log->function_table[i];
+		excimer_log_function *function;
+
+		if (!*slot) {
+			return slot;
+		}
+		function = &log->functions[*slot];
+		if (function->closure_line == key->closure_line
+			&& zend_string_equals(function->filename, key->filename)
+			&& excimer_log_string_equals(function->function_name, key->function_name)
+			&& excimer_log_string_equals(function->class_name, key->class_name))
+		{
+			return slot;
+		}
+		i = (i + 1) & mask;
+	}
+}
+
+/**
+ * Reallocate the function table if necessary so that it can hold the
+ * current number of functions, and reinsert the existing functions.
+ */
+static void excimer_log_function_table_resize(excimer_log *log)
+{
+	uint32_t truncated_function_index = log->truncated_frame_index
+		? log->frames[log->truncated_frame_index].function_index : 0;
+	uint32_t i;
+
+	if (!excimer_log_table_grow(&log->function_table, &log->function_table_mask,
+		log->functions_size))
+	{
+		return;
+	}
+	for (i = 1; i < log->functions_size; i++) {
+		if (i != truncated_function_index) {
+			*excimer_log_function_table_find(log, &log->functions[i]) = i;
+		}
+	}
+}
+
+/**
+ * Find the index of the function with the given key, adding it if it does
+ * not exist. The strings in the key are copied if the function is added.
+ */
+static uint32_t excimer_log_find_or_add_function(excimer_log *log,
+	excimer_log_function *key)
+{
+	uint32_t *slot = excimer_log_function_table_find(log, key);
+	uint32_t index;
+	excimer_log_function *function;
+
+	if (*slot) {
+		return *slot;
+	}
+
+	index = excimer_log_new_function(log);
+	*slot = index;
+	function = &log->functions[index];
+	function->filename = excimer_log_borrow_string(log, key->filename);
+	function->class_name = excimer_log_borrow_string(log, key->class_name);
+	function->function_name = excimer_log_borrow_string(log, key->function_name);
+	function->closure_line = key->closure_line;
+	function->start_line = key->start_line;
+
+	excimer_log_function_table_resize(log);
+	return index;
+}
+
+static uint32_t excimer_log_get_truncation_marker(excimer_log *log) {
+	uint32_t index, function_index;
+	excimer_log_frame *p_frame;
+	excimer_log_function *p_function;
+
+	if (log->truncated_frame_index) {
+		return log->truncated_frame_index;
+	}
+
+	/* The fake function is not added to the function table, so that it
+	 * cannot be confused with user code */
+	function_index = excimer_log_new_function(log);
+	p_function = &log->functions[function_index];
+	p_function->filename = zend_string_init(excimer_log_fake_filename,
+		sizeof(excimer_log_fake_filename) - 1, 0);
+	p_function->closure_line = 0;
+	p_function->start_line = 0;
+	p_function->class_name = NULL;
+	p_function->function_name = zend_string_init(excimer_log_truncated_name,
+		sizeof(excimer_log_truncated_name) - 1, 0);
+	excimer_log_own_string(log, p_function->filename);
+	excimer_log_own_string(log, p_function->function_name);
+
+	index = excimer_log_new_frame(log);
+	p_frame = &log->frames[index];
+	p_frame->function_index = function_index;
+	p_frame->lineno = 1;
+	p_frame->prev_index = 0;
+
+	log->truncated_frame_index = index;
+	return index;
+}
+
+/**
+ * Get the function index of a user function, adding it if necessary. The
+ * function cache is checked first, so that repeat samples in the same
+ * function do not need to hash the names.
+ *
+ * The index is not stored in the op_array itself, since opcache may put the
+ * op_array in shared memory, which is either read-only or shared with other
+ * processes with different logs.
+ */
+static uint32_t excimer_log_get_function_index(excimer_log *log, zend_function *func)
+{
+	excimer_log_function_cache_entry *cached;
+	excimer_log_function key;
+
+	if (!log->function_cache) {
+		log->function_cache = ecalloc(EXCIMER_LOG_FUNCTION_CACHE_SIZE,
+			sizeof(excimer_log_function_cache_entry));
+	}
+	cached = &log->function_cache[((uintptr_t)func >> 4)
+		& (EXCIMER_LOG_FUNCTION_CACHE_SIZE - 1)];
+
+	/* The op_arrays of included files and eval()'d code are freed after
+	 * they run without opcache, and a later one may be allocated at the same
+	 * address with the same opcodes pointer. So the filename is compared too.
+	 * The function table holds a reference to the cached filename, so it
+	 * cannot be freed and reused. */
+	if (cached->func == func
+		&& cached->opcodes == func->op_array.opcodes
+		&& cached->scope == func->common.scope
+		&& excimer_log_string_equals(log->functions[cached->function_index].filename,
+			func->op_array.filename))
+	{
+		return cached->function_index;
+	}
+
+	key.filename = func->op_array.filename;
+	key.class_name = func->common.scope ? func->common.scope->name : NULL;
+	key.function_name = func->common.function_name;
+	key.closure_line = (func->op_array.fn_flags & ZEND_ACC_CLOSURE)
+		? func->op_array.line_start : 0;
+	key.start_line = func->op_array.line_start;
+
+	cached->func = func;
+	cached->opcodes = func->op_array.opcodes;
+	cached->scope = func->common.scope;
+	cached->function_index = excimer_log_find_or_add_function(log, &key);
+	return cached->function_index;
+}
+
+/**
+ * Find or add the frame for a single VM frame, given the index of its
+ * calling frame.
+ */
+static uint32_t excimer_log_resolve_frame(excimer_log *log,
+	zend_execute_data *execute_data, uint32_t prev_index)
+{
+	if (!execute_data->func
+		|| !ZEND_USER_CODE(execute_data->func->common.type))
+	{
+		return prev_index;
+	} else {
+		zend_function *func = execute_data->func;
+		uint32_t lineno = execute_data->opline->lineno;
+		uint32_t function_index;
+		uint32_t *slot;
+		uint32_t index;
+		excimer_log_frame *frame;
+
+		function_index = excimer_log_get_function_index(log, func);
+
+		/* Look for a matching frame in the frame table */
+		slot = excimer_log_frame_table_find(log, function_index, lineno, prev_index);
+		if (*slot) {
+			return *slot;
+		}
+
+		/* Create a new entry in the array and frame table */
+		index = excimer_log_new_frame(log);
+		*slot = index;
+		frame = &log->frames[index];
+		frame->function_index = function_index;
+		frame->lineno = lineno;
+		frame->prev_index = prev_index;
+
+		excimer_log_frame_table_resize(log, log->frames_size);
+		return index;
+	}
+}
+
+/**
+ * Find the frame for a VM frame and its callers, adding it to the log if
+ * necessary.
+ *
+ * The VM frames are first collected into the walk buffer, then resolved
+ * starting from the outermost frame. Levels which are unchanged since the
+ * previous backtrace, that is, which have the same VM frame, function and
+ * opline as the corresponding level of the previous backtrace and all of its
+ * callers, are taken from the "stack" array without looking up the frame
+ * table.
+ */
+static uint32_t excimer_log_find_or_add_frame(excimer_log *log,
+	zend_execute_data *execute_data)
+{
+	size_t num_levels = 0;
+	size_t level;
+	zend_long depth = 0;
+	uint32_t frame_index = 0;
+	int matching;
+
+	/* Collect the VM frames, innermost first */
+	while (execute_data) {
+		if (num_levels >= log->walk_capacity) {
+			log->walk_buffer = excimer_log_grow(log->walk_buffer,
+				&log->walk_capacity, num_levels + 1, sizeof(zend_execute_data*));
+		}
+		log->walk_buffer[num_levels++] = execute_data;
+		if (!execute_data->prev_execute_data) {
+			break;
+		} else if (log->max_depth && depth >= log->max_depth) {
+			frame_index = excimer_log_get_truncation_marker(log);
+			break;
+		}
+		execute_data = execute_data->prev_execute_data;
+		depth++;
+	}
+
+	if (num_levels > log->stack_capacity) {
+		log->stack = excimer_log_grow(log->stack, &log->stack_capacity,
+			num_levels, sizeof(excimer_log_stack_level));
+	}
+
+	/* Resolve the frames, outermost first */
+	matching = log->stack_base == frame_index;
+	log->stack_base = frame_index;
+	for (level = 0; level < num_levels; level++) {
+		excimer_log_stack_level *cached = &log->stack[level];
+		execute_data = log->walk_buffer[num_levels - level - 1];
+
+		if (matching
+			&& level < log->stack_size
+			&& cached->execute_data == execute_data
+			&& cached->func == execute_data->func
+			&& cached->opline == execute_data->opline
+			&& (!cached->filename
+				|| (ZEND_USER_CODE(execute_data->func->common.type)
+					&& excimer_log_string_equals(cached->filename,
+						execute_data->func->op_array.filename)
+					&& log->frames[cached->frame_index].lineno
+						== execute_data->opline->lineno
+					&& log->functions[log->frames[cached->frame_index].function_index].start_line
+						== execute_data->func->op_array.line_start)))
+		{
+			frame_index = cached->frame_index;
+			continue;
+		}
+		matching = 0;
+		cached->execute_data = execute_data;
+		cached->func = execute_data->func;
+		cached->opline = execute_data->opline;
+		frame_index = excimer_log_resolve_frame(log, execute_data, frame_index);
+		cached->frame_index = frame_index;
+
+		/* A freed include or eval op_array may be reallocated at the same
+		 * address, and run in a recycled VM frame, so the filename, line
+		 * number and function start line are also checked. The filename is
+		 * taken from the function table, which keeps it alive. */
+		if (execute_data->func && ZEND_USER_CODE(execute_data->func->common.type)) {
+			cached->filename = log->functions[
+				log->frames[frame_index].function_index].filename;
+		} else {
+			cached->filename = NULL;
+		}
+	}
+
+	log->stack_size = num_levels;
+	return frame_index;
+}
+
+zend_long excimer_log_get_size(excimer_log *log)
+{
+	return log->entries_size;
+}
+
+zend_long excimer_log_get_sample_count(excimer_log *log)
+{
+	return log->entries_size + log->merged_samples + log->aggregated_samples;
+}
+
+uint64_t excimer_log_get_sample_timestamp(excimer_log_entry *entry, uint32_t i)
+{
+	if (i == 0 || entry->sample_count < 2) {
+		return entry->timestamp;
+	}
+	return entry->timestamp + (entry->end_timestamp - entry->timestamp)
+		* i / (entry->sample_count - 1);
+}
+
+/**
+ * Get the next sample from the log, for callers that do not need the
+ * timestamp. Entries are returned first, then each frame with a non-zero
+ * aggregated count is returned as a single sample. *pos should be
+ * initialised to zero.
+ *
+ * @param log The log object
+ * @param pos The iteration state
+ * @param frame_index The destination for the leaf frame index
+ * @param event_count The destination for the event count
+ * @return Zero if there are no more samples, non-zero otherwise
+ */
+static int excimer_log_next_sample(excimer_log *log, size_t *pos,
+	uint32_t *frame_index, zend_long *event_count)
+{
+	size_t num_counts = MIN(log->frame_counts_capacity, log->frames_size);
+
+	if (*pos < log->entries_size) {
+		excimer_log_entry *entry = excimer_log_get_entry(log, (*pos)++);
+		*frame_index = entry->frame_index;
+		*event_count = entry->event_count;
+		return 1;
+	}
+	while (*pos - log->entries_size < num_counts) {
+		size_t i = (*pos)++ - log->entries_size;
+		if (log->frame_counts[i]) {
+			*frame_index = (uint32_t)i;
+			*event_count = log->frame_counts[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Get the total event count of each leaf frame, combining entries and
+ * aggregated counts. The result is an array of frames_size elements. If
+ * *owned is set to non-zero, the caller must free it.
+ */
+static zend_long *excimer_log_get_frame_counts(excimer_log *log, int *owned)
+{
+	zend_long *counts;
+	size_t i;
+
+	if (!log->entries_size && log->frame_counts_capacity >= log->frames_size) {
+		*owned = 0;
+		return log->frame_counts;
+	}
+
+	counts = ecalloc(log->frames_size, sizeof(zend_long));
+	*owned = 1;
+	for (i = 0; i < log->entries_size; i++) {
+		excimer_log_entry *entry = excimer_log_get_entry(log, i);
+		counts[entry->frame_index] += entry->event_count;
+	}
+	for (i = 0; i < MIN(log->frame_counts_capacity, log->frames_size); i++) {
+		counts[i] += log->frame_counts[i];
+	}
+	return counts;
+}
+
+excimer_log_entry *excimer_log_get_entry(excimer_log *log, zend_long i)
+{
+	if (i >= 0 && i < log->entries_size) {
+		size_t index = log->entries_head + i;
+		if (log->ring_capacity && index >= log->ring_capacity) {
+			index -= log->ring_capacity;
+		}
+		return &log->entries[index];
+	} else {
+		return NULL;
+	}
+}
+
+uint64_t excimer_log_get_entries_base(excimer_log *log)
+{
+	/* The entries of a view are identified by their index in the parent */
+	return log->parent ? log->view_start : log->entries_base;
+}
+
+/**
+ * Find the index of the first entry with a timestamp greater than or equal
+ * to the given timestamp, or entries_size if there is no such entry.
+ */
+static size_t excimer_log_find_timestamp(excimer_log *log, uint64_t timestamp)
+{
+	size_t low = 0, high = log->entries_size;
+
+	while (low < high) {
+		size_t mid = low + (high - low) / 2;
+		if (excimer_log_get_entry(log, mid)->timestamp < timestamp) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+	return low;
+}
+
+void excimer_log_slice(excimer_log *view, excimer_log *log, uint64_t start, uint64_t end)
+{
+	uint64_t base = excimer_log_get_entries_base(log);
+	size_t first = excimer_log_find_timestamp(log, start);
+	size_t last = end > start ? excimer_log_find_timestamp(log, end) : first;
+
+	view->parent = log->parent ? log->parent : log;
+	view->view_start = base + first;
+	view->view_end = base + MAX(first, last);
+	view->max_depth = log->max_depth;
+	view->epoch = log->epoch;
+	view->period = log->period;
+	excimer_log_sync_view(view);
+}
+
+void excimer_log_sync_view(excimer_log *view)
+{
+	excimer_log *parent = view->parent;
+	uint64_t parent_end = parent->entries_base + parent->entries_size;
+	uint64_t start = MAX(view->view_start, parent->entries_base);
+	uint64_t end = MAX(start, MIN(view->view_end, parent_end));
+	size_t offset;
+	size_t i;
+
+	view->entries = parent->entries;
+	view->ring_capacity = parent->ring_capacity;
+	view->frames = parent->frames;
+	view->frames_size = parent->frames_size;
+	view->functions = parent->functions;
+	view->functions_size = parent->functions_size;
+	view->truncated_frame_index = parent->truncated_frame_index;
+
+	offset = parent->entries_head + (size_t)(start - parent->entries_base);
+	if (parent->ring_capacity && offset >= parent->ring_capacity) {
+		offset -= parent->ring_capacity;
+	}
+	view->entries_head = offset;
+
+	/* The totals only need to be recounted if entries were removed, or if a
+	 * sample may have been merged into the last entry. */
+	if (start == view->view_start
+		&& end - start == view->entries_size
+		&& (end < parent_end || parent->event_count == view->view_parent_event_count))
+	{
+		return;
+	}
+	view->view_start = start;
+	view->entries_size = (size_t)(end - start);
+	view->view_parent_event_count = parent->event_count;
+	view->event_count = 0;
+	view->merged_samples = 0;
+	for (i = 0; i < view->entries_size; i++) {
+		excimer_log_entry *entry = excimer_log_get_entry(view, i);
+		view->event_count += entry->event_count;
+		view->merged_samples += entry->sample_count - 1;
+	}
+}
+
+excimer_log_frame *excimer_log_get_frame(excimer_log *log, zend_long i)
+{
+	if (i > 0 && i < log->frames_size) {
+		return &log->frames[i];
+	} else {
+		return NULL;
+	}
+}
+
+excimer_log_function *excimer_log_get_function(excimer_log *log, zend_long i)
+{
+	if (i > 0 && i < log->functions_size) {
+		return &log->functions[i];
+	} else {
+		return NULL;
+	}
+}
+
+static void excimer_log_append_no_spaces(smart_str *dest, zend_string *src)
+{
+	size_t new_len = smart_str_alloc(dest, ZSTR_LEN(src), 0);
+	size_t prev_len = ZSTR_LEN(dest->s);
+	size_t i;
+	for (i = 0; i < ZSTR_LEN(src); i++) {
+		char c = ZSTR_VAL(src)[i];
+		if (c == ' ' || c == '\0') {
+			c = '_';
+		}
+		ZSTR_VAL(dest->s)[prev_len + i] = c;
+	}
+	ZSTR_LEN(dest->s) = new_len;
+}
+
+static void excimer_log_append_string(smart_str *ss, zend_string *str, int no_spaces)
+{
+	if (no_spaces) {
+		excimer_log_append_no_spaces(ss, str);
+	} else {
+		smart_str_append(ss, str);
+	}
+}
+
+/**
+ * Make a human-readable name for a function. If no_spaces is set, spaces
+ * and null bytes are replaced with underscores, as required by the collapsed
+ * format.
+ */
+static zend_string *excimer_log_make_function_name(excimer_log_function *function,
+	int no_spaces)
+{
+	smart_str ss = {NULL};
+
+	if (function->closure_line != 0) {
+		/* Annotate anonymous functions with their source location.
+		 * Example: {closure:/path/to/file.php(123)}
+		 */
+		smart_str_appends(&ss, "{closure:");
+		excimer_log_append_string(&ss, function->filename, no_spaces);
+		excimer_log_smart_str_append_printf(&ss, "(%d)}", function->closure_line);
+	} else if (function->function_name == NULL) {
+		/* For file-scope code, use the file name */
+		excimer_log_append_string(&ss, function->filename, no_spaces);
+	} else {
+		if (function->class_name) {
+			excimer_log_append_string(&ss, function->class_name, no_spaces);
+			smart_str_appends(&ss, "::");
+		}
+		excimer_log_append_string(&ss, function->function_name, no_spaces);
+	}
+	return excimer_log_smart_str_extract(&ss);
+}
+
+/**
+ * Get the name of a function, using a cache array with one element per
+ * function which was allocated by the caller with ecalloc().
+ */
+static zend_string *excimer_log_get_function_name(excimer_log *log,
+	zend_string **names, uint32_t function_index, int no_spaces)
+{
+	if (!names[function_index]) {
+		names[function_index] = excimer_log_make_function_name(
+			&log->functions[function_index], no_spaces);
+	}
+	return names[function_index];
+}
+
+/**
+ * Free a function name cache array
+ */
+static void excimer_log_free_function_names(excimer_log *log, zend_string **names)
+{
+	size_t i;
+	for (i = 0; i < log->functions_size; i++) {
+		if (names[i]) {
+			zend_string_release(names[i]);
+		}
+	}
+	efree(names);
+}
+
+/**
+ * Map each function to a name ID using a hashtable from names to IDs, adding
+ * any names which are not already there. The hashtable may be shared between
+ * logs, so that functions in different logs with the same name have the same
+ * ID. Name IDs start from 1.
+ *
+ * @param log The log object
+ * @param names A function name cache, as for excimer_log_get_function_name()
+ * @param no_spaces Passed through to excimer_log_get_function_name()
+ * @param ht_ids The hashtable of IDs keyed by name
+ * @return An array of name IDs indexed by function index, to be freed by the
+ *   caller
+ */
+static uint32_t *excimer_log_add_name_ids(excimer_log *log, zend_string **names,
+	int no_spaces, HashTable *ht_ids)
+{
+	uint32_t *name_ids = ecalloc(log->functions_size, sizeof(uint32_t));
+	uint32_t i;
+	zval *zp_id, z_tmp;
+
+	for (i = 1; i < log->functions_size; i++) {
+		zend_string *name = excimer_log_get_function_name(log, names, i, no_spaces);
+		zp_id = zend_hash_find(ht_ids, name);
+		if (!zp_id) {
+			ZVAL_LONG(&z_tmp, zend_hash_num_elements(ht_ids) + 1);
+			zp_id = zend_hash_add_new(ht_ids, name, &z_tmp);
+		}
+		name_ids[i] = (uint32_t)Z_LVAL_P(zp_id);
+	}
+	return name_ids;
+}
+
+/**
+ * Map each function to a name ID, so that functions with the same name
+ * share an ID. Name IDs start from 1.
+ *
+ * @param log The log object
+ * @param names A function name cache, as for excimer_log_get_function_name()
+ * @param no_spaces Passed through to excimer_log_get_function_name()
+ * @param num_names Destination for the number of unique names, or NULL
+ * @return An array of name IDs indexed by function index, to be freed by the
+ *   caller
+ */
+static uint32_t *excimer_log_get_name_ids(excimer_log *log, zend_string **names,
+	int no_spaces, uint32_t *num_names)
+{
+	HashTable ht_ids;
+	uint32_t *name_ids;
+
+	zend_hash_init(&ht_ids, log->functions_size, NULL, NULL, 0);
+	name_ids = excimer_log_add_name_ids(log, names, no_spaces, &ht_ids);
+	if (num_names) {
+		*num_names = zend_hash_num_elements(&ht_ids);
+	}
+	zend_hash_destroy(&ht_ids);
+	return name_ids;
+}
+
+/**
+ * A node in a tree of call paths, in which sibling frames with the same name
+ * are merged.
+ */
+typedef struct {
+	/** The parent node index */
+	uint32_t parent;
+	/** The name ID */
+	uint32_t name_id;
+	/** The index of any function with this name */
+	uint32_t function_index;
+	/** The first child node index, or zero */
+	uint32_t first_child;
+	/** The next sibling node index, or zero */
+	uint32_t next_sibling;
+	/** The event count of samples for which this is the leaf node */
+	zend_long count;
+} excimer_log_path_node;
+
+/**
+ * A tree of call paths. Node zero is the root.
+ */
+typedef struct {
+	excimer_log_path_node *nodes;
+	size_t size;
+	size_t capacity;
+
+	/** Open-addressing hashtable of node indexes, keyed by parent and name ID */
+	uint32_t *table;
+	uint32_t mask;
+} excimer_log_path_tree;
+
+/**
+ * Initialise a path tree with only the root node
+ */
+static void excimer_log_path_tree_init(excimer_log_path_tree *tree)
+{
+	tree->nodes = ecalloc(1, sizeof(excimer_log_path_node));
+	tree->size = 1;
+	tree->capacity = 1;
+	tree->mask = EXCIMER_LOG_MIN_FRAME_TABLE_SIZE - 1;
+	tree->table = ecalloc(EXCIMER_LOG_MIN_FRAME_TABLE_SIZE, sizeof(uint32_t));
+}
+
+/**
+ * Find the child of a node with the given name ID, adding it if it does not
+ * exist. A node always has a higher index than its parent.
+ *
+ * @param tree The path tree
+ * @param parent The parent node index
+ * @param name_id The name ID
+ * @param function_index The function to associate with a new node
+ * @return The node index
+ */
+static uint32_t excimer_log_path_tree_find_or_add(excimer_log_path_tree *tree,
+	uint32_t parent, uint32_t name_id, uint32_t function_index)
+{
+	uint32_t mask = tree->mask;
+	uint32_t h = excimer_log_frame_hash(name_id, 0, parent) & mask;
+	uint32_t node_index;
+	excimer_log_path_node *node;
+
+	while ((node_index = tree->table[h]) != 0) {
+		if (tree->nodes[node_index].parent == parent
+			&& tree->nodes[node_index].name_id == name_id)
+		{
+			return node_index;
+		}
+		h = (h + 1) & mask;
+	}
+
+	if (tree->size >= tree->capacity) {
+		tree->nodes = excimer_log_grow(tree->nodes, &tree->capacity,
+			tree->size + 1, sizeof(excimer_log_path_node));
+	}
+	node_index = excimer_safe_uint32(tree->size++);
+	tree->table[h] = node_index;
+	node = &tree->nodes[node_index];
+	node->parent = parent;
+	node->name_id = name_id;
+	node->function_index = function_index;
+	node->first_child = 0;
+	node->next_sibling = tree->nodes[parent].first_child;
+	node->count = 0;
+	tree->nodes[parent].first_child = node_index;
+
+	if (excimer_log_table_grow(&tree->table, &tree->mask, tree->size)) {
+		uint32_t j;
+		for (j = 1; j < tree->size; j++) {
+			h = excimer_log_frame_hash(tree->nodes[j].name_id, 0,
+				tree->nodes[j].parent) & tree->mask;
+			while (tree->table[h]) {
+				h = (h + 1) & tree->mask;
+			}
+			tree->table[h] = j;
+		}
+	}
+	return node_index;
+}
+
+/**
+ * Add the frames of a log to an existing path tree. The count of each node
+ * is increased by the sum of the given counts of the frames which map to it.
+ *
+ * @param log The log object
+ * @param tree The tree
+ * @param name_ids The name ID of each function
+ * @param frame_counts The event count of each frame, indexed by frame index,
+ *   or NULL to leave the counts unchanged
+ * @return The node index of each frame, indexed by frame index, to be freed
+ *   by the caller
+ */
+static uint32_t *excimer_log_path_tree_add(excimer_log *log, excimer_log_path_tree *tree,
+	uint32_t *name_ids, zend_long *frame_counts)
+{
+	uint32_t *frame_nodes = ecalloc(log->frames_size, sizeof(uint32_t));
+	uint32_t i;
+
+	if (frame_counts) {
+		tree->nodes[0].count += frame_counts[0];
+	}
+
+	/* A frame's parent always has a lower index, so its node is known */
+	for (i = 1; i < log->frames_size; i++) {
+		excimer_log_frame *frame = &log->frames[i];
+		uint32_t node_index = excimer_log_path_tree_find_or_add(tree,
+			frame_nodes[frame->prev_index], name_ids[frame->function_index],
+			frame->function_index);
+
+		frame_nodes[i] = node_index;
+		if (frame_counts) {
+			tree->nodes[node_index].count += frame_counts[i];
+		}
+	}
+	return frame_nodes;
+}
+
+/**
+ * Build a path tree from the frames of a log, as for
+ * excimer_log_path_tree_add().
+ *
+ * @param log The log object
+ * @param tree The tree to initialise
+ * @param name_ids The name ID of each function
+ * @param frame_counts The event count of each frame, or NULL
+ * @return The node index of each frame, to be freed by the caller
+ */
+static uint32_t *excimer_log_path_tree_build(excimer_log *log, excimer_log_path_tree *tree,
+	uint32_t *name_ids, zend_long *frame_counts)
+{
+	excimer_log_path_tree_init(tree);
+	return excimer_log_path_tree_add(log, tree, name_ids, frame_counts);
+}
+
+static void excimer_log_path_tree_destroy(excimer_log_path_tree *tree)
+{
+	efree(tree->nodes);
+	efree(tree->table);
+}
+
+/**
+ * Get the inclusive event count of each node of a path tree. A node always
+ * has a higher index than its parent, so the totals can be accumulated in a
+ * single reverse pass.
+ *
+ * @return An array indexed by node index, to be freed by the caller
+ */
+static zend_long *excimer_log_path_tree_get_totals(excimer_log_path_tree *tree)
+{
+	zend_long *totals = safe_emalloc(tree->size, sizeof(zend_long), 0);
+	size_t i;
+
+	for (i = 0; i < tree->size; i++) {
+		totals[i] = tree->nodes[i].count;
+	}
+	for (i = tree->size - 1; i > 0; i--) {
+		totals[tree->nodes[i].parent] += totals[i];
+	}
+	return totals;
+}
+
+/**
+ * Get the minimum event count of an unpruned subtree, given the total event
+ * count of the log. A node's total is never more than its parent's, so a
+ * node is pruned if and only if its own total is below the threshold.
+ */
+static zend_long excimer_log_get_prune_threshold(const excimer_log_prune_options *options,
+	zend_long total)
+{
+	double threshold;
+	zend_long min_count;
+
+	if (!options || !(options->min_fraction > 0)) {
+		return 0;
+	}
+	threshold = options->min_fraction * (double)total;
+	if (threshold >= (double)ZEND_LONG_MAX) {
+		return ZEND_LONG_MAX;
+	}
+	min_count = (zend_long)threshold;
+	return min_count < threshold ? min_count + 1 : min_count;
+}
+
+/**
+ * Get the number of decimal digits in a non-negative integer
+ */
+static size_t excimer_log_count_digits(zend_long n)
+{
+	size_t digits = 1;
+	while (n >= 10) {
+		n /= 10;
+		digits++;
+	}
+	return digits;
+}
+
+/**
+ * Get the size of the collapsed output of a path tree pruned at the given
+ * threshold.
+ *
+ * @param tree The path tree
+ * @param totals The inclusive total of each node
+ * @param path_lengths The length of the path of each node
+ * @param pruned Scratch space with one element per node
+ * @param min_count The pruning threshold
+ */
+static size_t excimer_log_get_collapsed_size(excimer_log_path_tree *tree,
+	zend_long *totals, size_t *path_lengths, zend_long *pruned, zend_long min_count)
+{
+	size_t size = 0;
+	size_t i;
+
+	memset(pruned, 0, tree->size * sizeof(zend_long));
+	if (tree->nodes[0].count) {
+		size += excimer_log_count_digits(tree->nodes[0].count) + 2;
+	}
+	for (i = 1; i < tree->size; i++) {
+		uint32_t parent = tree->nodes[i].parent;
+		if (totals[i] >= min_count) {
+			if (tree->nodes[i].count) {
+				size += path_lengths[i] + excimer_log_count_digits(tree->nodes[i].count) + 2;
+			}
+		} else if (!parent || totals[parent] >= min_count) {
+			pruned[parent] += totals[i];
+		}
+	}
+	for (i = 0; i < tree->size; i++) {
+		if (pruned[i]) {
+			size += path_lengths[i] + (i ? 1 : 0) + sizeof(excimer_log_pruned_name) - 1
+				+ excimer_log_count_digits(pruned[i]) + 2;
+		}
+	}
+	return size;
+}
+
+/**
+ * Find the lowest pruning threshold, not less than min_count, at which the
+ * collapsed output of a path tree fits in max_bytes. Pruning a single node
+ * can occasionally make the output longer, so this is approximate.
+ */
+static zend_long excimer_log_fit_collapsed(excimer_log_path_tree *tree,
+	zend_string **names, zend_long *totals, zend_long min_count, size_t max_bytes)
+{
+	size_t *path_lengths = safe_emalloc(tree->size, sizeof(size_t), 0);
+	zend_long *pruned = safe_emalloc(tree->size, sizeof(zend_long), 0);
+	zend_long low = min_count, high = totals[0] + 1;
+	size_t i;
+
+	path_lengths[0] = 0;
+	for (i = 1; i < tree->size; i++) {
+		excimer_log_path_node *node = &tree->nodes[i];
+		path_lengths[i] = path_lengths[node->parent] + (node->parent ? 1 : 0)
+			+ ZSTR_LEN(names[node->function_index]);
+	}
+
+	if (low >= high
+		|| excimer_log_get_collapsed_size(tree, totals, path_lengths, pruned, low) <= max_bytes)
+	{
+		high = low;
+	} else {
+		/* The output is too large at low. Bisect until it fits at high. */
+		while (high - low > 1) {
+			zend_long mid = low + (high - low) / 2;
+			if (excimer_log_get_collapsed_size(tree, totals, path_lengths,
+				pruned, mid) <= max_bytes)
+			{
+				high = mid;
+			} else {
+				low = mid;
+			}
+		}
+	}
+
+	efree(pruned);
+	efree(path_lengths);
+	return high;
+}
+
+static void excimer_log_output_collapsed(excimer_log *log, excimer_log_output *out,
+	const excimer_log_prune_options *options)
+{
+	smart_str *ss_out = &out->ss;
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t *name_ids;
+	zend_long *frame_counts;
+	int frame_counts_owned;
+	excimer_log_path_tree tree;
+	zend_long *totals;
+	zend_long min_count;
+	uint32_t *stack = NULL;
+	size_t stack_size = 0, stack_capacity = 0;
+	size_t *path_lengths;
+	char *path = NULL;
+	size_t path_capacity = 0;
+	uint32_t child;
+
+	/* Build the tree of paths, merging frames that differ only in hidden
+	 * line numbers */
+	frame_counts = excimer_log_get_frame_counts(log, &frame_counts_owned);
+	name_ids = excimer_log_get_name_ids(log, names, 1, NULL);
+	efree(excimer_log_path_tree_build(log, &tree, name_ids, frame_counts));
+	efree(name_ids);
+	if (frame_counts_owned) {
+		efree(frame_counts);
+	}
+
+	/* Subtrees with a total below min_count are merged into a synthetic
+	 * excimer_pruned frame under the parent */
+	totals = excimer_log_path_tree_get_totals(&tree);
+	min_count = excimer_log_get_prune_threshold(options, totals[0]);
+	if (options && options->max_bytes) {
+		min_count = excimer_log_fit_collapsed(&tree, names, totals, min_count,
+			options->max_bytes);
+	}
+
+	if (tree.nodes[0].count) {
+		excimer_log_smart_str_append_printf(ss_out, " " ZEND_LONG_FMT "\n",
+			tree.nodes[0].count);
+	}
+
+	/* Do a depth-first traversal. The path of the current node is kept in
+	 * a buffer, so the prefix shared with the parent is not rebuilt. */
+	path_lengths = safe_emalloc(tree.size, sizeof(size_t), 0);
+	path_lengths[0] = 0;
+	stack = excimer_log_grow(stack, &stack_capacity, 1, sizeof(uint32_t));
+	stack[stack_size++] = 0;
+	while (stack_size) {
+		uint32_t node_index = stack[--stack_size];
+		excimer_log_path_node *node = &tree.nodes[node_index];
+		size_t length = 0;
+		zend_long pruned = 0;
+
+		if (node_index) {
+			zend_string *name = names[node->function_index];
+
+			length = path_lengths[node->parent];
+			path = excimer_log_grow(path, &path_capacity, length + ZSTR_LEN(name) + 1, 1);
+			if (node->parent) {
+				path[length++] = ';';
+			}
+			memcpy(path + length, ZSTR_VAL(name), ZSTR_LEN(name));
+			length += ZSTR_LEN(name);
+			path_lengths[node_index] = length;
+
+			if (node->count) {
+				smart_str_appendl(ss_out, path, length);
+				smart_str_appendc(ss_out, ' ');
+				smart_str_append_long(ss_out, node->count);
+				smart_str_appendc(ss_out, '\n');
+				excimer_log_output_check(out);
+			}
+		}
+
+		for (child = node->first_child; child; child = tree.nodes[child].next_sibling) {
+			if (totals[child] < min_count) {
+				pruned += totals[child];
+				continue;
+			}
+			stack = excimer_log_grow(stack, &stack_capacity, stack_size + 1, sizeof(uint32_t));
+			stack[stack_size++] = child;
+		}
+
+		if (pruned) {
+			if (length) {
+				smart_str_appendl(ss_out, path, length);
+				smart_str_appendc(ss_out, ';');
+			}
+			smart_str_appendl(ss_out, excimer_log_pruned_name,
+				sizeof(excimer_log_pruned_name) - 1);
+			smart_str_appendc(ss_out, ' ');
+			smart_str_append_long(ss_out, pruned);
+			smart_str_appendc(ss_out, '\n');
+			excimer_log_output_check(out);
+		}
+	}
+
+	if (stack) {
+		efree(stack);
+	}
+	if (path) {
+		efree(path);
+	}
+	efree(path_lengths);
+	efree(totals);
+	excimer_log_path_tree_destroy(&tree);
+	excimer_log_free_function_names(log, names);
+}
+
+zend_string *excimer_log_format_collapsed(excimer_log *log,
+	const excimer_log_prune_options *options)
+{
+	excimer_log_output out;
+	excimer_log_output_init(&out, NULL);
+	excimer_log_output_collapsed(log, &out, options);
+	return excimer_log_output_to_string(&out);
+}
+
+int excimer_log_write_collapsed(excimer_log *log,
+	const excimer_log_prune_options *options, php_stream *stream)
+{
+	excimer_log_output out;
+	excimer_log_output_init(&out, stream);
+	excimer_log_output_collapsed(log, &out, options);
+	return excimer_log_output_close(&out);
+}
+
+static HashTable *excimer_log_function_to_speedscope_array(excimer_log_function *function,
+	zend_string *name)
+{
+	HashTable *ht_func = excimer_log_new_array(0);
+	zval tmp;
+
+	ZVAL_STR_COPY(&tmp, name);
+	zend_hash_str_add(ht_func, "name", sizeof("name")-1, &tmp);
+
+	if (function->filename) {
+		ZVAL_STR_COPY(&tmp, function->filename);
+		zend_hash_add_new(ht_func, excimer_log_known_string(ZEND_STR_FILE), &tmp);
+		/* Don't include the line number since it causes speedscope to split functions */
+	}
+	return ht_func;
+}
+
+static zend_string *excimer_log_get_speedscope_frame_key(excimer_log_function *function,
+	zend_string *name)
+{
+	smart_str ss = {NULL};
+
+	smart_str_append(&ss, name);
+	smart_str_appendc(&ss, '\0');
+	smart_str_append(&ss, function->filename);
+	return excimer_log_smart_str_extract(&ss);
+}
+
+static uint32_t excimer_log_count_frames(excimer_log *log, uint32_t frame_index) {
+	uint32_t n = 0;
+	while (frame_index) {
+		n++;
+		frame_index = log->frames[frame_index].prev_index;
+	}
+	return n;
+}
+
+/**
+ * Map each function to a speedscope frame index. Functions with the same
+ * name and filename share a speedscope frame.
+ *
+ * @param log The log object
+ * @param names A function name cache, as for excimer_log_get_function_name()
+ * @param unique Array with functions_size elements which receives the
+ *   function index of each speedscope frame
+ * @param num_unique Destination for the number of speedscope frames
+ * @return An array of speedscope frame indexes indexed by function index,
+ *   to be freed by the caller
+ */
+static uint32_t *excimer_log_map_speedscope_frames(excimer_log *log,
+	zend_string **names, uint32_t *unique, uint32_t *num_unique)
+{
+	HashTable *ht_indexes_by_key = excimer_log_new_array(0);
+	uint32_t *function_indexes = ecalloc(log->functions_size, sizeof(uint32_t));
+	uint32_t i;
+	zval *zp_frame_index;
+	zval z_tmp;
+
+	*num_unique = 0;
+	for (i = 1; i < log->functions_size; i++) {
+		excimer_log_function *function = &log->functions[i];
+		zend_string *str_key = excimer_log_get_speedscope_frame_key(function,
+			excimer_log_get_function_name(log, names, i, 1));
+		zp_frame_index = zend_hash_find(ht_indexes_by_key, str_key);
+		if (!zp_frame_index) {
+			unique[*num_unique] = i;
+			ZVAL_LONG(&z_tmp, (*num_unique)++);
+			zp_frame_index = zend_hash_add_new(ht_indexes_by_key, str_key, &z_tmp);
+		}
+		function_indexes[i] = (uint32_t)Z_LVAL_P(zp_frame_index);
+		zend_string_release(str_key);
+	}
+	zend_array_destroy(ht_indexes_by_key);
+	return function_indexes;
+}
+
+/**
+ * Get the speedscope endValue, in nanoseconds
+ */
+static uint64_t excimer_log_get_speedscope_end_value(excimer_log *log)
+{
+	if (log->aggregated_samples) {
+		/* There are no timestamps for aggregated samples, so use the total weight */
+		return log->event_count * log->period;
+	} else if (log->entries_size) {
+		return excimer_log_get_entry(log, log->entries_size - 1)->end_timestamp
+			- excimer_log_get_entry(log, 0)->timestamp;
+	} else {
+		return 0;
+	}
+}
+
+/**
+ * Append the samples of a pruned log to the speedscope samples and weights
+ * arrays. There is one sample per unpruned stack, and one for the pruned
+ * subtrees under each unpruned stack, so the samples are aggregated as in
+ * aggregate mode.
+ *
+ * @param log The log object
+ * @param function_indexes The speedscope frame index of each function
+ * @param pruned_frame The speedscope frame index of the excimer_pruned frame
+ * @param options The pruning options
+ * @param ht_samples The samples array
+ * @param ht_weights The weights array
+ */
+static void excimer_log_get_pruned_speedscope_samples(excimer_log *log,
+	uint32_t *function_indexes, uint32_t pruned_frame,
+	const excimer_log_prune_options *options,
+	HashTable *ht_samples, HashTable *ht_weights)
+{
+	uint32_t *name_ids = ecalloc(log->functions_size, sizeof(uint32_t));
+	zend_long *frame_counts;
+	int frame_counts_owned;
+	excimer_log_path_tree tree;
+	zend_long *totals, *pruned;
+	zend_long min_count;
+	uint32_t *stack = NULL;
+	size_t stack_capacity = 0;
+	size_t i;
+
+	/* Build the path tree over speedscope frames, offset by one since name
+	 * ID zero is reserved */
+	for (i = 1; i < log->functions_size; i++) {
+		name_ids[i] = function_indexes[i] + 1;
+	}
+	frame_counts = excimer_log_get_frame_counts(log, &frame_counts_owned);
+	efree(excimer_log_path_tree_build(log, &tree, name_ids, frame_counts));
+	efree(name_ids);
+	if (frame_counts_owned) {
+		efree(frame_counts);
+	}
+
+	totals = excimer_log_path_tree_get_totals(&tree);
+	min_count = excimer_log_get_prune_threshold(options, totals[0]);
+	pruned = ecalloc(tree.size, sizeof(zend_long));
+	for (i = 1; i < tree.size; i++) {
+		uint32_t parent = tree.nodes[i].parent;
+		if (totals[i] < min_count && (!parent || totals[parent] >= min_count)) {
+			pruned[parent] += totals[i];
+		}
+	}
+
+	for (i = 0; i < tree.size; i++) {
+		int pass;
+
+		if (i && totals[i] < min_count) {
+			continue;
+		}
+		/* The first pass emits the node's own samples, the second pass emits
+		 * its pruned children */
+		for (pass = 0; pass < 2; pass++) {
+			zend_long count = pass ? pruned[i] : tree.nodes[i].count;
+			uint32_t node_index = (uint32_t)i;
+			size_t depth = 0;
+			HashTable *ht_stack;
+			zval z_tmp;
+
+			if (!count) {
+				continue;
+			}
+			if (pass) {
+				stack = excimer_log_grow(stack, &stack_capacity, 1, sizeof(uint32_t));
+				stack[depth++] = pruned_frame;
+			}
+			while (node_index) {
+				stack = excimer_log_grow(stack, &stack_capacity, depth + 1, sizeof(uint32_t));
+				stack[depth++] = tree.nodes[node_index].name_id - 1;
+				node_index = tree.nodes[node_index].parent;
+			}
+
+			/* The stack was collected leaf first */
+			ht_stack = excimer_log_new_array(depth);
+			while (depth) {
+				ZVAL_LONG(&z_tmp, stack[--depth]);
+				zend_hash_next_index_insert_new(ht_stack, &z_tmp);
+			}
+			ZVAL_ARR(&z_tmp, ht_stack);
+			zend_hash_next_index_insert_new(ht_samples, &z_tmp);
+
+			ZVAL_LONG(&z_tmp, count * log->period);
+			zend_hash_next_index_insert_new(ht_weights, &z_tmp);
+		}
+	}
+
+	if (stack) {
+		efree(stack);
+	}
+	efree(pruned);
+	efree(totals);
+	excimer_log_path_tree_destroy(&tree);
+}
+
+void excimer_log_get_speedscope_data(excimer_log *log,
+	const excimer_log_prune_options *options, zval *zp_data)
+{
+	int prune = options && options->min_fraction > 0;
+
+	array_init(zp_data);
+	add_assoc_string(zp_data, "$schema", "https://www.speedscope.app/file-format-schema.json");
+	add_assoc_string(zp_data, "exporter", "Excimer");
+
+	HashTable *ht_frames = excimer_log_new_array(0);
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t *unique = safe_emalloc(log->functions_size, sizeof(uint32_t), 0);
+	uint32_t num_unique;
+	uint32_t *function_indexes;
+	uint32_t i;
+	zval z_tmp, *zp_tmp;
+
+	/* Build the frames array. A speedscope frame corresponds to one of our
+	 * functions, since the line number is omitted. */
+	function_indexes = excimer_log_map_speedscope_frames(log, names, unique, &num_unique);
+	for (i = 0; i < num_unique; i++) {
+		ZVAL_ARR(&z_tmp, excimer_log_function_to_speedscope_array(
+			&log->functions[unique[i]], names[unique[i]]));
+		zend_hash_next_index_insert_new(ht_frames, &z_tmp);
+	}
+	if (prune) {
+		HashTable *ht_pruned = excimer_log_new_array(0);
+
+		ZVAL_STRINGL(&z_tmp, excimer_log_pruned_name, sizeof(excimer_log_pruned_name) - 1);
+		zend_hash_str_add_new(ht_pruned, "name", sizeof("name")-1, &z_tmp);
+		ZVAL_ARR(&z_tmp, ht_pruned);
+		zend_hash_next_index_insert_new(ht_frames, &z_tmp);
+	}
+	excimer_log_free_function_names(log, names);
+	efree(unique);
+
+	/* zp_data["shared"] = ["frames" => ht_frames] */
+	zval z_shared;
+	array_init(&z_shared);
+	excimer_log_add_assoc_array(&z_shared, "frames", ht_frames);
+	add_assoc_zval(zp_data, "shared", &z_shared);
+
+	/* Build the samples and weights arrays */
+	HashTable *ht_samples = excimer_log_new_array(log->entries_size);
+	HashTable *ht_weights = excimer_log_new_array(log->entries_size);
+	size_t pos = 0;
+	uint32_t frame_index;
+	zend_long event_count;
+
+	if (prune) {
+		excimer_log_get_pruned_speedscope_samples(log, function_indexes, num_unique,
+			options, ht_samples, ht_weights);
+	} else {
+		while (excimer_log_next_sample(log, &pos, &frame_index, &event_count)) {
+			uint32_t num_frames = excimer_log_count_frames(log, frame_index);
+			uint32_t j;
+
+			/* Create the array with ZEND_HASH_FILL_PACKED. This is just a fast way
+			 * to get it into the right state, with num_frames elements. */
+			HashTable *ht_stack = excimer_log_new_array(num_frames);
+			zend_hash_extend(ht_stack, num_frames, 1);
+			ZEND_HASH_FILL_PACKED(ht_stack) {
+#if PHP_VERSION_ID < 70400
+				zval new_val;
+
+				ZVAL_LONG(&new_val, 0);
+				for (j = 0; j < num_frames; j++) {
+					ZEND_HASH_FILL_ADD(&new_val);
+				}
+#else
+				for (j = 0; j < num_frames; j++) {
+					ZEND_HASH_FILL_SET_LONG(0);
+					ZEND_HASH_FILL_NEXT();
+				}
+#endif
+			} ZEND_HASH_FILL_END();
+
+			/* Write the values in reverse order */
+			ZEND_HASH_REVERSE_FOREACH_VAL(ht_stack, zp_tmp) {
+				excimer_log_frame *frame = &log->frames[frame_index];
+				ZVAL_LONG(zp_tmp, function_indexes[frame->function_index]);
+				frame_index = frame->prev_index;
+			}
+			ZEND_HASH_FOREACH_END();
+
+			ZVAL_ARR(&z_tmp, ht_stack);
+			zend_hash_next_index_insert_new(ht_samples, &z_tmp);
+
+			ZVAL_LONG(&z_tmp, event_count * log->period);
+			zend_hash_next_index_insert_new(ht_weights, &z_tmp);
+		}
+	}
+
+	/* Build the profile array */
+	zval z_profile;
+	array_init(&z_profile);
+	add_assoc_string(&z_profile, "type", "sampled");
+	add_assoc_string(&z_profile, "name", "");
+	add_assoc_string(&z_profile, "unit", "nanoseconds");
+	add_assoc_long(&z_profile, "startValue", 0);
+	add_assoc_long(&z_profile, "endValue", prune
+		? (zend_long)(log->event_count * log->period)
+		: (zend_long)excimer_log_get_speedscope_end_value(log));
+	excimer_log_add_assoc_array(&z_profile, "samples", ht_samples);
+	excimer_log_add_assoc_array(&z_profile, "weights", ht_weights);
+
+	/* zp_data["profiles"] = [profile] */
+	zval z_profiles;
+	array_init(&z_profiles);
+	add_next_index_zval(&z_profiles, &z_profile);
+	add_assoc_zval(zp_data, "profiles", &z_profiles);
+
+	efree(function_indexes);
+}
+
+/**
+ * Append a string to a smart_str as a quoted JSON string. Bytes 0x80 and
+ * above are copied unchanged, so the input is assumed to be UTF-8.
+ */
+static void excimer_log_append_json_string(smart_str *ss, const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i, start = 0;
+
+	smart_str_appendc(ss, '"');
+	for (i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)str[i];
+		if (c >= 0x20 && c != '"' && c != '\\') {
+			continue;
+		}
+		smart_str_appendl(ss, str + start, i - start);
+		start = i + 1;
+		switch (c) {
+			case '"':
+				smart_str_appendl(ss, "\\\"", 2);
+				break;
+			case '\\':
+				smart_str_appendl(ss, "\\\\", 2);
+				break;
+			case '\n':
+				smart_str_appendl(ss, "\\n", 2);
+				break;
+			case '\r':
+				smart_str_appendl(ss, "\\r", 2);
+				break;
+			case '\t':
+				smart_str_appendl(ss, "\\t", 2);
+				break;
+			default:
+				smart_str_appendl(ss, "\\u00", 4);
+				smart_str_appendc(ss, hex[c >> 4]);
+				smart_str_appendc(ss, hex[c & 0xf]);
+		}
+	}
+	smart_str_appendl(ss, str + start, len - start);
+	smart_str_appendc(ss, '"');
+}
+
+static void excimer_log_append_json_zstr(smart_str *ss, zend_string *str)
+{
+	excimer_log_append_json_string(ss, ZSTR_VAL(str), ZSTR_LEN(str));
+}
+
+/**
+ * Write the start of a speedscope JSON document, up to and including the
+ * shared frames array.
+ *
+ * @return The speedscope frame index of each function, to be freed by the
+ *   caller
+ */
+static uint32_t *excimer_log_output_speedscope_frames(excimer_log *log,
+	excimer_log_output *out)
+{
+	smart_str *ss = &out->ss;
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t *unique = safe_emalloc(log->functions_size, sizeof(uint32_t), 0);
+	uint32_t num_unique;
+	uint32_t *function_indexes;
+	uint32_t i;
+
+	smart_str_appends(ss, "{\"$schema\":\"https://www.speedscope.app/file-format-schema.json\","
+		"\"exporter\":\"Excimer\",\"shared\":{\"frames\":[");
+
+	function_indexes = excimer_log_map_speedscope_frames(log, names, unique, &num_unique);
+	for (i = 0; i < num_unique; i++) {
+		excimer_log_function *function = &log->functions[unique[i]];
+		if (i) {
+			smart_str_appendc(ss, ',');
+		}
+		smart_str_appends(ss, "{\"name\":");
+		excimer_log_append_json_zstr(ss, names[unique[i]]);
+		if (function->filename) {
+			smart_str_appends(ss, ",\"file\":");
+			excimer_log_append_json_zstr(ss, function->filename);
+		}
+		smart_str_appendc(ss, '}');
+		excimer_log_output_check(out);
+	}
+	smart_str_appends(ss, "]}");
+
+	excimer_log_free_function_names(log, names);
+	efree(unique);
+	return function_indexes;
+}
+
+static void excimer_log_output_speedscope(excimer_log *log, excimer_log_output *out)
+{
+	smart_str *ss = &out->ss;
+	uint32_t *stack = NULL;
+	size_t stack_capacity = 0;
+	uint32_t *function_indexes;
+	size_t pos;
+	uint32_t frame_index;
+	zend_long event_count;
+	int first;
+
+	function_indexes = excimer_log_output_speedscope_frames(log, out);
+
+	smart_str_appends(ss, ",\"profiles\":[{\"type\":\"sampled\",\"name\":\"\","
+		"\"unit\":\"nanoseconds\",\"startValue\":0,\"endValue\":");
+	smart_str_append_unsigned(ss, excimer_log_get_speedscope_end_value(log));
+
+	/* Samples: each is an array of frame indexes, outermost first */
+	smart_str_appends(ss, ",\"samples\":[");
+	pos = 0;
+	first = 1;
+	while (excimer_log_next_sample(log, &pos, &frame_index, &event_count)) {
+		size_t num_frames = 0;
+
+		while (frame_index) {
+			excimer_log_frame *frame = &log->frames[frame_index];
+			if (num_frames >= stack_capacity) {
+				stack = excimer_log_grow(stack, &stack_capacity, num_frames + 1,
+					sizeof(uint32_t));
+			}
+			stack[num_frames++] = function_indexes[frame->function_index];
+			frame_index = frame->prev_index;
+		}
+
+		if (!first) {
+			smart_str_appendc(ss, ',');
+		}
+		first = 0;
+		smart_str_appendc(ss, '[');
+		while (num_frames--) {
+			smart_str_append_unsigned(ss, stack[num_frames]);
+			if (num_frames) {
+				smart_str_appendc(ss, ',');
+			}
+		}
+		smart_str_appendc(ss, ']');
+		excimer_log_output_check(out);
+	}
+
+	/* Weights */
+	smart_str_appends(ss, "],\"weights\":[");
+	pos = 0;
+	first = 1;
+	while (excimer_log_next_sample(log, &pos, &frame_index, &event_count)) {
+		if (!first) {
+			smart_str_appendc(ss, ',');
+		}
+		first = 0;
+		smart_str_append_long(ss, event_count * log->period);
+		excimer_log_output_check(out);
+	}
+	smart_str_appends(ss, "]}]}");
+
+	if (stack) {
+		efree(stack);
+	}
+	efree(function_indexes);
+}
+
+EXCIMER_LOG_DEFINE_OUTPUTS(speedscope)
+
+/* {{{ Protocol buffer encoding */
+
+#define EXCIMER_PB_VARINT 0
+#define EXCIMER_PB_BYTES 2
+
+static void excimer_pb_append_varint(smart_str *ss, uint64_t value)
+{
+	char buf[10];
+	size_t len = 0;
+
+	while (value >= 0x80) {
+		buf[len++] = (char)(value | 0x80);
+		value >>= 7;
+	}
+	buf[len++] = (char)value;
+	smart_str_appendl(ss, buf, len);
+}
+
+static void excimer_pb_append_tag(smart_str *ss, uint32_t field, uint32_t wire_type)
+{
+	excimer_pb_append_varint(ss, (uint64_t)field << 3 | wire_type);
+}
+
+/**
+ * Append an integer field. Zero is the default value, so it is omitted.
+ */
+static void excimer_pb_append_int(smart_str *ss, uint32_t field, uint64_t value)
+{
+	if (value) {
+		excimer_pb_append_tag(ss, field, EXCIMER_PB_VARINT);
+		excimer_pb_append_varint(ss, value);
+	}
+}
+
+/**
+ * Append a length-delimited field: a string, an embedded message or a
+ * packed repeated field.
+ */
+static void excimer_pb_append_bytes(smart_str *ss, uint32_t field,
+	const char *data, size_t len)
+{
+	excimer_pb_append_tag(ss, field, EXCIMER_PB_BYTES);
+	excimer_pb_append_varint(ss, len);
+	smart_str_appendl(ss, data, len);
+}
+
+/**
+ * Append an embedded message which was built in a scratch buffer, and clear
+ * the scratch buffer for reuse.
+ */
+static void excimer_pb_append_message(smart_str *ss, uint32_t field, smart_str *msg)
+{
+	size_t len = excimer_log_smart_str_get_len(msg);
+	excimer_pb_append_bytes(ss, field, len ? ZSTR_VAL(msg->s) : "", len);
+	if (msg->s) {
+		ZSTR_LEN(msg->s) = 0;
+	}
+}
+
+/* }}} */
+
+/* {{{ pprof export */
+
+/* Field numbers from profile.proto */
+#define EXCIMER_PPROF_PROFILE_SAMPLE_TYPE 1
+#define EXCIMER_PPROF_PROFILE_SAMPLE 2
+#define EXCIMER_PPROF_PROFILE_LOCATION 4
+#define EXCIMER_PPROF_PROFILE_FUNCTION 5
+#define EXCIMER_PPROF_PROFILE_STRING_TABLE 6
+#define EXCIMER_PPROF_PROFILE_TIME_NANOS 9
+#define EXCIMER_PPROF_PROFILE_DURATION_NANOS 10
+#define EXCIMER_PPROF_PROFILE_PERIOD_TYPE 11
+#define EXCIMER_PPROF_PROFILE_PERIOD 12
+#define EXCIMER_PPROF_VALUE_TYPE_TYPE 1
+#define EXCIMER_PPROF_VALUE_TYPE_UNIT 2
+#define EXCIMER_PPROF_SAMPLE_LOCATION_ID 1
+#define EXCIMER_PPROF_SAMPLE_VALUE 2
+#define EXCIMER_PPROF_LOCATION_ID 1
+#define EXCIMER_PPROF_LOCATION_LINE 4
+#define EXCIMER_PPROF_LINE_FUNCTION_ID 1
+#define EXCIMER_PPROF_LINE_LINE 2
+#define EXCIMER_PPROF_FUNCTION_ID 1
+#define EXCIMER_PPROF_FUNCTION_NAME 2
+#define EXCIMER_PPROF_FUNCTION_SYSTEM_NAME 3
+#define EXCIMER_PPROF_FUNCTION_FILENAME 4
+#define EXCIMER_PPROF_FUNCTION_START_LINE 5
+
+/**
+ * Get the index of a string in the pprof string table, adding it to the
+ * table if necessary.
+ */
+static uint64_t excimer_log_pprof_string(smart_str *ss, HashTable *ht_strings,
+	const char *str, size_t len)
+{
+	zval *zp_index = zend_hash_str_find(ht_strings, str, len);
+	zval z_index;
+
+	if (zp_index) {
+		return Z_LVAL_P(zp_index);
+	}
+	ZVAL_LONG(&z_index, zend_hash_num_elements(ht_strings));
+	zend_hash_str_add_new(ht_strings, str, len, &z_index);
+	excimer_pb_append_bytes(ss, EXCIMER_PPROF_PROFILE_STRING_TABLE, str, len);
+	return Z_LVAL(z_index);
+}
+
+static uint64_t excimer_log_pprof_zstr(smart_str *ss, HashTable *ht_strings, zend_string *str)
+{
+	return excimer_log_pprof_string(ss, ht_strings, ZSTR_VAL(str), ZSTR_LEN(str));
+}
+
+/**
+ * Append a ValueType message with the given type and unit
+ */
+static void excimer_log_pprof_value_type(smart_str *ss, smart_str *msg,
+	HashTable *ht_strings, uint32_t field, const char *type, const char *unit)
+{
+	excimer_pb_append_int(msg, EXCIMER_PPROF_VALUE_TYPE_TYPE,
+		excimer_log_pprof_string(ss, ht_strings, type, strlen(type)));
+	excimer_pb_append_int(msg, EXCIMER_PPROF_VALUE_TYPE_UNIT,
+		excimer_log_pprof_string(ss, ht_strings, unit, strlen(unit)));
+	excimer_pb_append_message(ss, field, msg);
+}
+
+static void excimer_log_output_pprof(excimer_log *log, excimer_log_output *out,
+	uint64_t time_nanos)
+{
+	smart_str *ss = &out->ss;
+	smart_str msg = {NULL};
+	smart_str packed = {NULL};
+	HashTable ht_strings;
+	zend_long *frame_counts;
+	int frame_counts_owned;
+	uint64_t duration;
+	uint32_t i;
+
+	excimer_log_output_enable_gzip(out);
+
+	zend_hash_init(&ht_strings, 0, NULL, NULL, 0);
+	/* The first string in the table must be empty */
+	excimer_log_pprof_string(ss, &ht_strings, "", 0);
+
+	/* Sample types: the number of events, and the time they represent. The
+	 * first is named "events" since an entry may represent several timer
+	 * events, and aggregated frames have no sample count. */
+	excimer_log_pprof_value_type(ss, &msg, &ht_strings,
+		EXCIMER_PPROF_PROFILE_SAMPLE_TYPE, "events", "count");
+	excimer_log_pprof_value_type(ss, &msg, &ht_strings,
+		EXCIMER_PPROF_PROFILE_SAMPLE_TYPE, "time", "nanoseconds");
+
+	/* One sample per unique stack, with the location IDs leaf first */
+	frame_counts = excimer_log_get_frame_counts(log, &frame_counts_owned);
+	for (i = 1; i < log->frames_size; i++) {
+		uint32_t frame_index;
+
+		if (!frame_counts[i]) {
+			continue;
+		}
+		for (frame_index = i; frame_index; frame_index = log->frames[frame_index].prev_index) {
+			excimer_pb_append_varint(&packed, frame_index);
+		}
+		excimer_pb_append_message(&msg, EXCIMER_PPROF_SAMPLE_LOCATION_ID, &packed);
+		excimer_pb_append_varint(&packed, frame_counts[i]);
+		excimer_pb_append_varint(&packed, frame_counts[i] * log->period);
+		excimer_pb_append_message(&msg, EXCIMER_PPROF_SAMPLE_VALUE, &packed);
+		excimer_pb_append_message(ss, EXCIMER_PPROF_PROFILE_SAMPLE, &msg);
+		excimer_log_output_check(out);
+	}
+	if (frame_counts_owned) {
+		efree(frame_counts);
+	}
+
+	/* A location for each frame, with the frame index as its ID */
+	for (i = 1; i < log->frames_size; i++) {
+		excimer_log_frame *frame = &log->frames[i];
+		excimer_pb_append_int(&msg, EXCIMER_PPROF_LOCATION_ID, i);
+		excimer_pb_append_int(&packed, EXCIMER_PPROF_LINE_FUNCTION_ID, frame->function_index);
+		excimer_pb_append_int(&packed, EXCIMER_PPROF_LINE_LINE, frame->lineno);
+		excimer_pb_append_message(&msg, EXCIMER_PPROF_LOCATION_LINE, &packed);
+		excimer_pb_append_message(ss, EXCIMER_PPROF_PROFILE_LOCATION, &msg);
+		excimer_log_output_check(out);
+	}
+
+	/* A function for each function, with the function index as its ID */
+	for (i = 1; i < log->functions_size; i++) {
+		excimer_log_function *function = &log->functions[i];
+		zend_string *name = excimer_log_make_function_name(function, 0);
+		uint64_t name_index = excimer_log_pprof_zstr(ss, &ht_strings, name);
+
+		excimer_pb_append_int(&msg, EXCIMER_PPROF_FUNCTION_ID, i);
+		excimer_pb_append_int(&msg, EXCIMER_PPROF_FUNCTION_NAME, name_index);
+		excimer_pb_append_int(&msg, EXCIMER_PPROF_FUNCTION_SYSTEM_NAME, name_index);
+		excimer_pb_append_int(&msg, EXCIMER_PPROF_FUNCTION_FILENAME,
+			excimer_log_pprof_zstr(ss, &ht_strings, function->filename));
+		if (function->start_line) {
+			excimer_pb_append_int(&msg, EXCIMER_PPROF_FUNCTION_START_LINE,
+				function->start_line);
+		}
+		excimer_pb_append_message(ss, EXCIMER_PPROF_PROFILE_FUNCTION, &msg);
+		zend_string_release(name);
+		excimer_log_output_check(out);
+	}
+
+	/* The header. The duration is measured from the first entry to the end
+	 * of the last, since the epoch is only set for logs created by a
+	 * profiler. It is omitted if there are no timestamped entries. */
+	excimer_pb_append_int(ss, EXCIMER_PPROF_PROFILE_TIME_NANOS, time_nanos);
+	if (log->entries_size) {
+		duration = excimer_log_get_entry(log, log->entries_size - 1)->end_timestamp
+			- excimer_log_get_entry(log, 0)->timestamp;
+		excimer_pb_append_int(ss, EXCIMER_PPROF_PROFILE_DURATION_NANOS, duration);
+	}
+	excimer_log_pprof_value_type(ss, &msg, &ht_strings,
+		EXCIMER_PPROF_PROFILE_PERIOD_TYPE, "time", "nanoseconds");
+	excimer_pb_append_int(ss, EXCIMER_PPROF_PROFILE_PERIOD, log->period);
+
+	zend_hash_destroy(&ht_strings);
+	smart_str_free(&msg);
+	smart_str_free(&packed);
+}
+
+zend_string *excimer_log_format_pprof(excimer_log *log, uint64_t time_nanos)
+{
+	excimer_log_output out;
+	excimer_log_output_init(&out, NULL);
+	excimer_log_output_pprof(log, &out, time_nanos);
+	return excimer_log_output_to_string(&out);
+}
+
+int excimer_log_write_pprof(excimer_log *log, uint64_t time_nanos, php_stream *stream)
+{
+	excimer_log_output out;
+	excimer_log_output_init(&out, stream);
+	excimer_log_output_pprof(log, &out, time_nanos);
+	return excimer_log_output_close(&out);
+}
+
+/* }}} */
+
+/* {{{ Callgrind export */
+
+/**
+ * Append a compressed name specification such as "fn=(3) foo". The name is
+ * only written the first time the ID is used.
+ */
+static void excimer_log_callgrind_name(smart_str *ss, const char *spec,
+	uint32_t id, zend_string *name, zend_bool *emitted)
+{
+	smart_str_appends(ss, spec);
+	smart_str_appendc(ss, '(');
+	smart_str_append_unsigned(ss, id);
+	smart_str_appendc(ss, ')');
+	if (!emitted[id]) {
+		emitted[id] = 1;
+		smart_str_appendc(ss, ' ');
+		smart_str_append(ss, name);
+	}
+	smart_str_appendc(ss, '\n');
+}
+
+/**
+ * Append a cost line with the given position and event count
+ */
+static void excimer_log_callgrind_cost(smart_str *ss, excimer_log *log,
+	uint32_t lineno, zend_long count)
+{
+	smart_str_append_unsigned(ss, lineno);
+	smart_str_appendc(ss, ' ');
+	smart_str_append_long(ss, count);
+	smart_str_appendc(ss, ' ');
+	smart_str_append_long(ss, count * log->period);
+	smart_str_appendc(ss, '\n');
+}
+
+static void excimer_log_output_callgrind(excimer_log *log, excimer_log_output *out)
+{
+	smart_str *ss = &out->ss;
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t num_names, num_files = 0;
+	uint32_t *name_ids = excimer_log_get_name_ids(log, names, 0, &num_names);
+	uint32_t *file_ids = ecalloc(log->functions_size, sizeof(uint32_t));
+	zend_bool *name_emitted, *file_emitted;
+	zend_long *frame_counts, *inclusive;
+	int frame_counts_owned;
+	uint32_t *first_child, *next_sibling;
+	uint32_t *by_function, *function_starts;
+	uint32_t i, f;
+	HashTable ht_files;
+	zval *zp_id, z_tmp;
+
+	/* Assign file IDs, starting from 1 */
+	zend_hash_init(&ht_files, 0, NULL, NULL, 0);
+	for (i = 1; i < log->functions_size; i++) {
+		zp_id = zend_hash_find(&ht_files, log->functions[i].filename);
+		if (!zp_id) {
+			ZVAL_LONG(&z_tmp, ++num_files);
+			zp_id = zend_hash_add_new(&ht_files, log->functions[i].filename, &z_tmp);
+		}
+		file_ids[i] = (uint32_t)Z_LVAL_P(zp_id);
+	}
+	zend_hash_destroy(&ht_files);
+	name_emitted = ecalloc(num_names + 1, sizeof(zend_bool));
+	file_emitted = ecalloc(num_files + 1, sizeof(zend_bool));
+
+	/* Compute inclusive counts and child lists. A frame's parent always has
+	 * a lower index, so one reverse pass propagates the counts. */
+	frame_counts = excimer_log_get_frame_counts(log, &frame_counts_owned);
+	inclusive = safe_emalloc(log->frames_size, sizeof(zend_long), 0);
+	memcpy(inclusive, frame_counts, log->frames_size * sizeof(zend_long));
+	first_child = ecalloc(log->frames_size, sizeof(uint32_t));
+	next_sibling = ecalloc(log->frames_size, sizeof(uint32_t));
+	for (i = (uint32_t)log->frames_size - 1; i > 0; i--) {
+		uint32_t parent = log->frames[i].prev_index;
+		if (parent && inclusive[i]) {
+			inclusive[parent] += inclusive[i];
+			next_sibling[i] = first_child[parent];
+			first_child[parent] = i;
+		}
+	}
+
+	/* Group the frames by function with a counting sort */
+	function_starts = ecalloc(log->functions_size + 1, sizeof(uint32_t));
+	by_function = safe_emalloc(log->frames_size, sizeof(uint32_t), 0);
+	for (i = 1; i < log->frames_size; i++) {
+		function_starts[log->frames[i].function_index + 1]++;
+	}
+	for (f = 1; f <= log->functions_size; f++) {
+		function_starts[f] += function_starts[f - 1];
+	}
+	for (i = 1; i < log->frames_size; i++) {
+		by_function[function_starts[log->frames[i].function_index]++] = i;
+	}
+	/* function_starts[f] is now the end of function f, and function zero is
+	 * empty, so function f starts at function_starts[f - 1] */
+
+	smart_str_appends(ss, "# callgrind format\n"
+		"version: 1\n"
+		"creator: Excimer\n"
+		"positions: line\n"
+		"event: Samples : Event count\n"
+		"event: Time : Time (ns)\n"
+		"events: Samples Time\n");
+
+	for (f = 1; f < log->functions_size; f++) {
+		uint32_t start = function_starts[f - 1];
+		uint32_t end = function_starts[f];
+		uint32_t j;
+		int header_done = 0;
+
+		for (j = start; j < end; j++) {
+			uint32_t frame_index = by_function[j];
+			excimer_log_frame *frame = &log->frames[frame_index];
+			uint32_t child;
+
+			if (!inclusive[frame_index]) {
+				continue;
+			}
+			if (!header_done) {
+				smart_str_appendc(ss, '\n');
+				excimer_log_callgrind_name(ss, "fl=", file_ids[f],
+					log->functions[f].filename, file_emitted);
+				excimer_log_callgrind_name(ss, "fn=", name_ids[f],
+					names[f], name_emitted);
+				header_done = 1;
+			}
+
+			/* Self cost at the sampled line */
+			if (frame_counts[frame_index]) {
+				excimer_log_callgrind_cost(ss, log, frame->lineno,
+					frame_counts[frame_index]);
+			}
+
+			/* Inclusive cost of each callee at the call site line */
+			for (child = first_child[frame_index]; child; child = next_sibling[child]) {
+				uint32_t callee = log->frames[child].function_index;
+				excimer_log_callgrind_name(ss, "cfl=", file_ids[callee],
+					log->functions[callee].filename, file_emitted);
+				excimer_log_callgrind_name(ss, "cfn=", name_ids[callee],
+					names[callee], name_emitted);
+				smart_str_appends(ss, "calls=");
+				smart_str_append_long(ss, inclusive[child]);
+				smart_str_appendc(ss, ' ');
+				smart_str_append_unsigned(ss, log->frames[child].lineno);
+				smart_str_appendc(ss, '\n');
+				excimer_log_callgrind_cost(ss, log, frame->lineno, inclusive[child]);
+			}
+			excimer_log_output_check(out);
+		}
+	}
+
+	efree(by_function);
+	efree(function_starts);
+	efree(next_sibling);
+	efree(first_child);
+	efree(inclusive);
+	if (frame_counts_owned) {
+		efree(frame_counts);
+	}
+	efree(file_emitted);
+	efree(name_emitted);
+	efree(file_ids);
+	efree(name_ids);
+	excimer_log_free_function_names(log, names);
+}
+
+EXCIMER_LOG_DEFINE_OUTPUTS(callgrind)
+
+/* }}} */
+
+/* {{{ Timeline export */
+
+/**
+ * Get the next sample in time order, for timeline exporters. Samples merged
+ * by run-length encoding are returned individually with their interpolated
+ * times. Aggregated samples have no timestamp and are not returned. *pos and
+ * *sub_pos should be initialised to zero.
+ *
+ * @return Zero if there are no more samples, non-zero otherwise
+ */
+static int excimer_log_next_timed_sample(excimer_log *log, size_t *pos,
+	uint32_t *sub_pos, uint32_t *frame_index, uint64_t *timestamp)
+{
+	excimer_log_entry *entry = excimer_log_get_entry(log, *pos);
+
+	if (!entry) {
+		return 0;
+	}
+	*frame_index = entry->frame_index;
+	*timestamp = excimer_log_get_sample_timestamp(entry, (*sub_pos)++);
+	if (*sub_pos >= entry->sample_count) {
+		(*pos)++;
+		*sub_pos = 0;
+	}
+	return 1;
+}
+
+/**
+ * Append a non-negative integer number of nanoseconds as a decimal number of
+ * microseconds (unit_digits=3) or milliseconds (unit_digits=6).
+ */
+static void excimer_log_append_ns(smart_str *ss, uint64_t ns, int unit_digits)
+{
+	uint64_t divisor = unit_digits == 3 ? 1000 : 1000000;
+	uint64_t frac = ns % divisor;
+	char buf[8];
+	int i;
+
+	smart_str_append_unsigned(ss, (zend_ulong)(ns / divisor));
+	if (frac) {
+		for (i = unit_digits - 1; i >= 0; i--) {
+			buf[i] = '0' + frac % 10;
+			frac /= 10;
+		}
+		smart_str_appendc(ss, '.');
+		smart_str_appendl(ss, buf, unit_digits);
+	}
+}
+
+/**
+ * Get a function name as a quoted JSON string, using a cache array with one
+ * element per function. This is the string table shared by the timeline
+ * exporters, so that each name is escaped only once.
+ */
+static zend_string *excimer_log_get_json_name(excimer_log *log,
+	zend_string **json_names, zend_string **names, uint32_t function_index)
+{
+	if (!json_names[function_index]) {
+		smart_str ss = {NULL};
+		zend_string *name = excimer_log_get_function_name(log, names,
+			function_index, 0);
+		excimer_log_append_json_string(&ss, ZSTR_VAL(name), ZSTR_LEN(name));
+		json_names[function_index] = excimer_log_smart_str_extract(&ss);
+	}
+	return json_names[function_index];
+}
+
+static void excimer_log_chrome_event(smart_str *ss, zend_string *json_name,
+	char phase, uint64_t ns, int *first)
+{
+	if (!*first) {
+		smart_str_appendc(ss, ',');
+	}
+	*first = 0;
+	smart_str_appends(ss, "\n{\"name\":");
+	smart_str_append(ss, json_name);
+	smart_str_appends(ss, ",\"cat\":\"php\",\"ph\":\"");
+	smart_str_appendc(ss, phase);
+	smart_str_appends(ss, "\",\"ts\":");
+	excimer_log_append_ns(ss, ns, 3);
+	smart_str_appends(ss, ",\"pid\":1,\"tid\":1}");
+}
+
+/**
+ * A function called by excimer_log_walk_timeline() when a call begins or
+ * ends
+ *
+ * @param context The context passed to excimer_log_walk_timeline()
+ * @param node_index The path tree node of the call
+ * @param open Non-zero if the call begins, zero if it ends
+ * @param ns The time in nanoseconds since the epoch
+ */
+typedef void (*excimer_log_timeline_handler)(void *context, uint32_t node_index,
+	int open, uint64_t ns);
+
+/**
+ * Infer calls from the stacks of consecutive timed samples, in a single
+ * pass. Between samples, the calls which are no longer on the stack are
+ * ended and the new ones are begun. Frames which map to the same path tree
+ * node are the same call. The last sample represents the period before it
+ * was taken, so everything is ended at the time of the last sample.
+ *
+ * @param log The log object
+ * @param tree The path tree
+ * @param frame_nodes The node index of each frame
+ * @param out The output, which is flushed as necessary after each sample
+ * @param handler The function to call for each event
+ * @param context Passed through to the handler
+ */
+static void excimer_log_walk_timeline(excimer_log *log, excimer_log_path_tree *tree,
+	uint32_t *frame_nodes, excimer_log_output *out,
+	excimer_log_timeline_handler handler, void *context)
+{
+	uint32_t *depths = safe_emalloc(tree->size, sizeof(uint32_t), 0);
+	uint32_t *pushed = NULL;
+	size_t pushed_capacity = 0;
+	uint32_t prev = 0;
+	uint64_t ns = 0;
+	size_t pos = 0;
+	uint32_t sub_pos = 0;
+	uint32_t frame_index;
+	uint64_t timestamp;
+	size_t i;
+
+	/* Nodes are created after their parents */
+	depths[0] = 0;
+	for (i = 1; i < tree->size; i++) {
+		depths[i] = depths[tree->nodes[i].parent] + 1;
+	}
+
+	while (excimer_log_next_timed_sample(log, &pos, &sub_pos, &frame_index, &timestamp)) {
+		uint32_t a = prev;
+		uint32_t b = frame_nodes[frame_index];
+		size_t num_pushed = 0;
+
+		ns = timestamp > log->epoch ? timestamp - log->epoch : 0;
+		while (a != b) {
+			if (depths[a] >= depths[b]) {
+				handler(context, a, 0, ns);
+				a = tree->nodes[a].parent;
+			} else {
+				pushed = excimer_log_grow(pushed, &pushed_capacity, num_pushed + 1,
+					sizeof(uint32_t));
+				pushed[num_pushed++] = b;
+				b = tree->nodes[b].parent;
+			}
+		}
+		while (num_pushed--) {
+			handler(context, pushed[num_pushed], 1, ns);
+		}
+		prev = frame_nodes[frame_index];
+		excimer_log_output_check(out);
+	}
+
+	while (prev) {
+		handler(context, prev, 0, ns);
+		prev = tree->nodes[prev].parent;
+	}
+
+	if (pushed) {
+		efree(pushed);
+	}
+	efree(depths);
+}
+
+typedef struct {
+	excimer_log *log;
+	smart_str *ss;
+	excimer_log_path_tree *tree;
+	zend_string **names;
+	zend_string **json_names;
+	int first;
+} excimer_log_chrome_context;
+
+static void excimer_log_chrome_handler(void *context, uint32_t node_index,
+	int open, uint64_t ns)
+{
+	excimer_log_chrome_context *ctx = context;
+
+	excimer_log_chrome_event(ctx->ss, excimer_log_get_json_name(ctx->log,
+		ctx->json_names, ctx->names, ctx->tree->nodes[node_index].function_index),
+		open ? 'B' : 'E', ns, &ctx->first);
+}
+
+static void excimer_log_output_chrome_trace(excimer_log *log, excimer_log_output *out)
+{
+	excimer_log_chrome_context ctx;
+	excimer_log_path_tree tree;
+	uint32_t *name_ids;
+	uint32_t *frame_nodes;
+
+	ctx.log = log;
+	ctx.ss = &out->ss;
+	ctx.tree = &tree;
+	ctx.names = ecalloc(log->functions_size, sizeof(zend_string*));
+	ctx.json_names = ecalloc(log->functions_size, sizeof(zend_string*));
+	ctx.first = 1;
+
+	/* Frames which differ only in line number are the same call */
+	name_ids = excimer_log_get_name_ids(log, ctx.names, 0, NULL);
+	frame_nodes = excimer_log_path_tree_build(log, &tree, name_ids, NULL);
+	efree(name_ids);
+
+	smart_str_appends(ctx.ss, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+	excimer_log_walk_timeline(log, &tree, frame_nodes, out,
+		excimer_log_chrome_handler, &ctx);
+	smart_str_appends(ctx.ss, "\n]}");
+
+	efree(frame_nodes);
+	excimer_log_path_tree_destroy(&tree);
+	excimer_log_free_function_names(log, ctx.json_names);
+	excimer_log_free_function_names(log, ctx.names);
+}
+
+EXCIMER_LOG_DEFINE_OUTPUTS(chrome_trace)
+
+typedef struct {
+	smart_str *ss;
+	excimer_log_path_tree *tree;
+	uint64_t start;
+	uint64_t end;
+	int first;
+} excimer_log_evented_context;
+
+static void excimer_log_evented_handler(void *context, uint32_t node_index,
+	int open, uint64_t ns)
+{
+	excimer_log_evented_context *ctx = context;
+
+	if (ctx->first) {
+		ctx->start = ns;
+	} else {
+		smart_str_appendc(ctx->ss, ',');
+	}
+	ctx->first = 0;
+	ctx->end = ns;
+	smart_str_appends(ctx->ss, "\n{\"type\":\"");
+	smart_str_appendc(ctx->ss, open ? 'O' : 'C');
+	smart_str_appends(ctx->ss, "\",\"frame\":");
+	/* The name ID is the speedscope frame index plus one */
+	smart_str_append_unsigned(ctx->ss, ctx->tree->nodes[node_index].name_id - 1);
+	smart_str_appends(ctx->ss, ",\"at\":");
+	smart_str_append_unsigned(ctx->ss, ns);
+	smart_str_appendc(ctx->ss, '}');
+}
+
+static void excimer_log_output_speedscope_evented(excimer_log *log, excimer_log_output *out)
+{
+	excimer_log_evented_context ctx;
+	excimer_log_path_tree tree;
+	uint32_t *function_indexes;
+	uint32_t *name_ids = ecalloc(log->functions_size, sizeof(uint32_t));
+	uint32_t *frame_nodes;
+	size_t i;
+
+	ctx.ss = &out->ss;
+	ctx.tree = &tree;
+	ctx.start = 0;
+	ctx.end = 0;
+	ctx.first = 1;
+
+	/* Calls are identified by speedscope frame, which ignores line numbers.
+	 * Name ID zero is reserved, so the name IDs are offset by one. */
+	function_indexes = excimer_log_output_speedscope_frames(log, out);
+	for (i = 1; i < log->functions_size; i++) {
+		name_ids[i] = function_indexes[i] + 1;
+	}
+	frame_nodes = excimer_log_path_tree_build(log, &tree, name_ids, NULL);
+	efree(name_ids);
+	efree(function_indexes);
+
+	smart_str_appends(ctx.ss, ",\"profiles\":[{\"type\":\"evented\",\"name\":\"\","
+		"\"unit\":\"nanoseconds\",\"events\":[");
+	excimer_log_walk_timeline(log, &tree, frame_nodes, out,
+		excimer_log_evented_handler, &ctx);
+	smart_str_appends(ctx.ss, "\n],\"startValue\":");
+	smart_str_append_unsigned(ctx.ss, ctx.start);
+	smart_str_appends(ctx.ss, ",\"endValue\":");
+	smart_str_append_unsigned(ctx.ss, ctx.end);
+	smart_str_appends(ctx.ss, "}]}");
+
+	efree(frame_nodes);
+	excimer_log_path_tree_destroy(&tree);
+}
+
+EXCIMER_LOG_DEFINE_OUTPUTS(speedscope_evented)
+
+static void excimer_log_output_gecko(excimer_log *log, excimer_log_output *out,
+	uint64_t start_time)
+{
+	smart_str *ss = &out->ss;
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	size_t pos = 0;
+	uint32_t sub_pos = 0;
+	uint32_t frame_index;
+	uint64_t timestamp;
+	int first = 1;
+	size_t i;
+
+	smart_str_appends(ss, "{\"meta\":{\"version\":24,\"startTime\":");
+	excimer_log_append_ns(ss, start_time, 6);
+	smart_str_appends(ss, ",\"interval\":");
+	excimer_log_append_ns(ss, log->period, 6);
+	smart_str_appends(ss, ",\"shutdownTime\":null,\"processType\":0,\"product\":\"Excimer\","
+		"\"stackwalk\":0,\"debug\":0,\"gcpoison\":0,\"asyncstack\":0,"
+		"\"categories\":[{\"name\":\"PHP\",\"color\":\"blue\",\"subcategories\":[\"Other\"]}],"
+		"\"markerSchema\":[]},"
+		"\"libs\":[],\"pausedRanges\":[],\"processes\":[],"
+		"\"threads\":[{\"name\":\"PHP\",\"processType\":\"default\",\"tid\":1,\"pid\":1,"
+		"\"registerTime\":0,\"unregisterTime\":null,"
+		"\"markers\":{\"schema\":{\"name\":0,\"startTime\":1,\"endTime\":2,\"phase\":3,"
+		"\"category\":4,\"data\":5},\"data\":[]},");
+
+	/* Samples refer to the stack table, in which stack i - 1 is frame i */
+	smart_str_appends(ss, "\n\"samples\":{\"schema\":{\"stack\":0,\"time\":1},\"data\":[");
+	while (excimer_log_next_timed_sample(log, &pos, &sub_pos, &frame_index, &timestamp)) {
+		if (!first) {
+			smart_str_appendc(ss, ',');
+		}
+		first = 0;
+		smart_str_appendc(ss, '[');
+		if (frame_index) {
+			smart_str_append_unsigned(ss, frame_index - 1);
+		} else {
+			smart_str_appends(ss, "null");
+		}
+		smart_str_appendc(ss, ',');
+		excimer_log_append_ns(ss, timestamp > log->epoch ? timestamp - log->epoch : 0, 6);
+		smart_str_appendc(ss, ']');
+		excimer_log_output_check(out);
+	}
+
+	/* Stack table: one stack per frame, with the parent as its prefix */
+	smart_str_appends(ss, "]},\n\"stackTable\":{\"schema\":{\"prefix\":0,\"frame\":1},\"data\":[");
+	for (i = 1; i < log->frames_size; i++) {
+		uint32_t prev_index = log->frames[i].prev_index;
+		if (i > 1) {
+			smart_str_appendc(ss, ',');
+		}
+		smart_str_appendc(ss, '[');
+		if (prev_index) {
+			smart_str_append_unsigned(ss, prev_index - 1);
+		} else {
+			smart_str_appends(ss, "null");
+		}
+		smart_str_appendc(ss, ',');
+		smart_str_append_unsigned(ss, i - 1);
+		smart_str_appendc(ss, ']');
+		excimer_log_output_check(out);
+	}
+
+	/* Frame table: one frame per frame, with a location string per function */
+	smart_str_appends(ss, "]},\n\"frameTable\":{\"schema\":{\"location\":0,"
+		"\"relevantForJS\":1,\"innerWindowID\":2,\"implementation\":3,\"line\":4,"
+		"\"column\":5,\"category\":6,\"subcategory\":7},\"data\":[");
+	for (i = 1; i < log->frames_size; i++) {
+		excimer_log_frame *frame = &log->frames[i];
+		if (i > 1) {
+			smart_str_appendc(ss, ',');
+		}
+		smart_str_appendc(ss, '[');
+		smart_str_append_unsigned(ss, frame->function_index - 1);
+		smart_str_appends(ss, ",false,0,null,");
+		smart_str_append_unsigned(ss, frame->lineno);
+		smart_str_appends(ss, ",null,0,0]");
+		excimer_log_output_check(out);
+	}
+
+	/* String table: "name (file)" for each function */
+	smart_str_appends(ss, "]},\n\"stringTable\":[");
+	for (i = 1; i < log->functions_size; i++) {
+		excimer_log_function *function = &log->functions[i];
+		zend_string *name = excimer_log_get_function_name(log, names, i, 0);
+		smart_str location = {NULL};
+
+		smart_str_append(&location, name);
+		smart_str_appends(&location, " (");
+		smart_str_append(&location, function->filename);
+		smart_str_appendc(&location, ')');
+		smart_str_0(&location);
+
+		if (i > 1) {
+			smart_str_appendc(ss, ',');
+		}
+		excimer_log_append_json_string(ss, ZSTR_VAL(location.s), ZSTR_LEN(location.s));
+		smart_str_free(&location);
+		excimer_log_output_check(out);
+	}
+	smart_str_appends(ss, "]}]}");
+
+	excimer_log_free_function_names(log, names);
+}
+
+zend_string *excimer_log_format_gecko(excimer_log *log, uint64_t start_time)
+{
+	excimer_log_output out;
+	excimer_log_output_init(&out, NULL);
+	excimer_log_output_gecko(log, &out, start_time);
+	return excimer_log_output_to_string(&out);
+}
+
+int excimer_log_write_gecko(excimer_log *log, uint64_t start_time, php_stream *stream)
+{
+	excimer_log_output out;
+	excimer_log_output_init(&out, stream);
+	excimer_log_output_gecko(log, &out, start_time);
+	return excimer_log_output_close(&out);
+}
+
+/* }}} */
+
+/* {{{ Flame graph rendering */
+
+/* Layout constants, the same as the defaults of flamegraph.pl */
+#define EXCIMER_LOG_FG_FRAME_HEIGHT 16
+#define EXCIMER_LOG_FG_FONT_SIZE 12
+#define EXCIMER_LOG_FG_FONT_WIDTH 0.59
+#define EXCIMER_LOG_FG_XPAD 10
+#define EXCIMER_LOG_FG_YPAD1 (EXCIMER_LOG_FG_FONT_SIZE * 3)
+#define EXCIMER_LOG_FG_YPAD2 (EXCIMER_LOG_FG_FONT_SIZE * 2 + 10)
+
+/**
+ * Append a non-negative number rounded to two decimal places, without the
+ * locale dependence of printf.
+ */
+static void excimer_log_append_decimal(smart_str *ss, double value)
+{
+	uint64_t hundredths = (uint64_t)(value * 100 + 0.5);
+	uint64_t frac = hundredths % 100;
+
+	smart_str_append_unsigned(ss, (zend_ulong)(hundredths / 100));
+	if (frac) {
+		smart_str_appendc(ss, '.');
+		smart_str_appendc(ss, '0' + frac / 10);
+		if (frac % 10) {
+			smart_str_appendc(ss, '0' + frac % 10);
+		}
+	}
+}
+
+/**
+ * Append a string to a smart_str with XML escaping. Control characters which
+ * are not allowed in XML 1.0 are replaced with "?".
+ */
+static void excimer_log_append_xml_string(smart_str *ss, const char *str, size_t len)
+{
+	size_t i, start = 0;
+
+	for (i = 0; i < len; i++) {
+		unsigned char c = (unsigned char)str[i];
+		if ((c >= 0x20 || c == '\t' || c == '\n' || c == '\r')
+			&& c != '&' && c != '<' && c != '>' && c != '"')
+		{
+			continue;
+		}
+		smart_str_appendl(ss, str + start, i - start);
+		start = i + 1;
+		switch (c) {
+			case '&':
+				smart_str_appendl(ss, "&amp;", 5);
+				break;
+			case '<':
+				smart_str_appendl(ss, "&lt;", 4);
+				break;
+			case '>':
+				smart_str_appendl(ss, "&gt;", 4);
+				break;
+			case '"':
+				smart_str_appendl(ss, "&quot;", 6);
+				break;
+			default:
+				smart_str_appendc(ss, '?');
+		}
+	}
+	smart_str_appendl(ss, str + start, len - start);
+}
+
+/**
+ * A child node in excimer_log_output_flame_graph(), sorted by name
+ */
+typedef struct {
+	zend_string *name;
+	uint32_t node_index;
+} excimer_log_flame_sort_item;
+
+static int excimer_log_flame_compare(const void *a, const void *b)
+{
+	const excimer_log_flame_sort_item *item_a = a;
+	const excimer_log_flame_sort_item *item_b = b;
+
+	return zend_binary_strcmp(ZSTR_VAL(item_a->name), ZSTR_LEN(item_a->name),
+		ZSTR_VAL(item_b->name), ZSTR_LEN(item_b->name));
+}
+
+static void excimer_log_flame_swap(void *a, void *b)
+{
+	excimer_log_flame_sort_item tmp = *(excimer_log_flame_sort_item*)a;
+	*(excimer_log_flame_sort_item*)a = *(excimer_log_flame_sort_item*)b;
+	*(excimer_log_flame_sort_item*)b = tmp;
+}
+
+/**
+ * Append one frame of a flame graph: a rectangle with a tooltip and, if it
+ * fits, a label.
+ */
+static void excimer_log_flame_frame(smart_str *ss, zend_string *name,
+	zend_long count, zend_long total, double x, double y, double w)
+{
+	zend_ulong h = zend_string_hash_val(name);
+	size_t max_chars = (size_t)(w / (EXCIMER_LOG_FG_FONT_SIZE * EXCIMER_LOG_FG_FONT_WIDTH));
+
+	/* Use the "hot" palette of flamegraph.pl, with colours derived from a hash
+	 * of the name so that they are stable across renders */
+	smart_str_appends(ss, "<g><title>");
+	excimer_log_append_xml_string(ss, ZSTR_VAL(name), ZSTR_LEN(name));
+	smart_str_appends(ss, " (");
+	smart_str_append_long(ss, count);
+	smart_str_appends(ss, " samples, ");
+	excimer_log_append_decimal(ss, total ? count * 100.0 / total : 0);
+	smart_str_appends(ss, "%)</title><rect x=\"");
+	excimer_log_append_decimal(ss, x);
+	smart_str_appends(ss, "\" y=\"");
+	excimer_log_append_decimal(ss, y);
+	smart_str_appends(ss, "\" width=\"");
+	excimer_log_append_decimal(ss, w);
+	excimer_log_smart_str_append_printf(ss,
+		"\" height=\"%d\" fill=\"rgb(%d,%d,%d)\" rx=\"2\" ry=\"2\"/>",
+		EXCIMER_LOG_FG_FRAME_HEIGHT - 1,
+		(int)(205 + ((h >> 16) & 0xff) * 50 / 255),
+		(int)((h & 0xff) * 230 / 255),
+		(int)(((h >> 8) & 0xff) * 55 / 255));
+
+	/* Truncate the label to fit, without splitting a UTF-8 character */
+	if (max_chars >= 3) {
+		size_t len = ZSTR_LEN(name);
+		int truncated = 0;
+
+		if (len > max_chars) {
+			len = max_chars - 2;
+			while (len && ((unsigned char)ZSTR_VAL(name)[len] & 0xc0) == 0x80) {
+				len--;
+			}
+			truncated = 1;
+		}
+		smart_str_appends(ss, "<text x=\"");
+		excimer_log_append_decimal(ss, x + 3);
+		smart_str_appends(ss, "\" y=\"");
+		excimer_log_append_decimal(ss, y + 10.5);
+		smart_str_appends(ss, "\">");
+		excimer_log_append_xml_string(ss, ZSTR_VAL(name), len);
+		if (truncated) {
+			smart_str_appends(ss, "..");
+		}
+		smart_str_appends(ss, "</text>");
+	}
+	smart_str_appends(ss, "</g>\n");
+}
+
+static void excimer_log_output_flame_graph(excimer_log *log, excimer_log_output *out,
+	const excimer_log_flame_graph_options *options)
+{
+	smart_str *ss = &out->ss;
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	zend_string *root_name;
+	uint32_t *name_ids;
+	zend_long *frame_counts;
+	int frame_counts_owned;
+	excimer_log_path_tree tree;
+	zend_long *totals, *offsets;
+	uint32_t *depths, *visible;
+	size_t num_visible = 0;
+	excimer_log_flame_sort_item *items = NULL;
+	size_t items_capacity = 0;
+	double width = (double)options->width;
+	double scale;
+	zend_long height;
+	size_t i;
+
+	/* Build the tree of paths. Frames are merged by their full name. */
+	frame_counts = excimer_log_get_frame_counts(log, &frame_counts_owned);
+	name_ids = excimer_log_get_name_ids(log, names, 0, NULL);
+	efree(excimer_log_path_tree_build(log, &tree, name_ids, frame_counts));
+	efree(name_ids);
+	if (frame_counts_owned) {
+		efree(frame_counts);
+	}
+
+	totals = excimer_log_path_tree_get_totals(&tree);
+	scale = totals[0] && width > 2 * EXCIMER_LOG_FG_XPAD
+		? (width - 2 * EXCIMER_LOG_FG_XPAD) / totals[0] : 0;
+
+	/* Lay out the visible nodes breadth first, using the visible array as the
+	 * queue. Siblings are sorted by name, as in flamegraph.pl. The offset of
+	 * a node is in events from the left edge. Nodes narrower than the minimum
+	 * width are skipped along with their descendants, but still take up
+	 * space. */
+	offsets = ecalloc(tree.size, sizeof(zend_long));
+	depths = ecalloc(tree.size, sizeof(uint32_t));
+	visible = safe_emalloc(tree.size, sizeof(uint32_t), 0);
+	if (totals[0] && totals[0] * scale >= options->min_width) {
+		visible[num_visible++] = 0;
+	}
+	for (i = 0; i < num_visible; i++) {
+		uint32_t node_index = visible[i];
+		zend_long offset = offsets[node_index];
+		size_t num_items = 0, j;
+		uint32_t child;
+
+		for (child = tree.nodes[node_index].first_child; child;
+			child = tree.nodes[child].next_sibling)
+		{
+			items = excimer_log_grow(items, &items_capacity, num_items + 1,
+				sizeof(excimer_log_flame_sort_item));
+			items[num_items].name = names[tree.nodes[child].function_index];
+			items[num_items].node_index = child;
+			num_items++;
+		}
+		zend_sort(items, num_items, sizeof(excimer_log_flame_sort_item),
+			excimer_log_flame_compare, excimer_log_flame_swap);
+
+		for (j = 0; j < num_items; j++) {
+			child = items[j].node_index;
+			offsets[child] = offset;
+			offset += totals[child];
+			if (totals[child] && totals[child] * scale >= options->min_width) {
+				depths[child] = depths[node_index] + 1;
+				visible[num_visible++] = child;
+			}
+		}
+	}
+
+	height = (zend_long)((num_visible ? depths[visible[num_visible - 1]] + 1 : 1)
+		* EXCIMER_LOG_FG_FRAME_HEIGHT + EXCIMER_LOG_FG_YPAD1 + EXCIMER_LOG_FG_YPAD2);
+
+	smart_str_appends(ss, "<?xml version=\"1.0\" standalone=\"no\"?>\n"
+		"<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" "
+		"\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n");
+	excimer_log_smart_str_append_printf(ss,
+		"<svg version=\"1.1\" width=\"" ZEND_LONG_FMT "\" height=\"" ZEND_LONG_FMT "\" "
+		"viewBox=\"0 0 " ZEND_LONG_FMT " " ZEND_LONG_FMT "\" "
+		"xmlns=\"http://www.w3.org/2000/svg\">\n",
+		options->width, height, options->width, height);
+	excimer_log_smart_str_append_printf(ss,
+		"<style type=\"text/css\">text{font-family:Verdana,sans-serif;"
+		"font-size:%dpx;fill:#000}</style>\n"
+		"<rect x=\"0\" y=\"0\" width=\"100%%\" height=\"100%%\" fill=\"#eeeeee\"/>\n",
+		EXCIMER_LOG_FG_FONT_SIZE);
+	smart_str_appends(ss, "<text x=\"");
+	excimer_log_append_decimal(ss, width / 2);
+	excimer_log_smart_str_append_printf(ss,
+		"\" y=\"%d\" text-anchor=\"middle\" style=\"font-size:%dpx\">",
+		EXCIMER_LOG_FG_FONT_SIZE * 2, EXCIMER_LOG_FG_FONT_SIZE + 5);
+	if (options->title) {
+		excimer_log_append_xml_string(ss, ZSTR_VAL(options->title),
+			ZSTR_LEN(options->title));
+	} else {
+		smart_str_appends(ss, "Flame Graph");
+	}
+	smart_str_appends(ss, "</text>\n");
+
+	root_name = zend_string_init("all", sizeof("all") - 1, 0);
+	for (i = 0; i < num_visible; i++) {
+		uint32_t node_index = visible[i];
+		zend_string *name = node_index
+			? names[tree.nodes[node_index].function_index] : root_name;
+
+		excimer_log_flame_frame(ss, name, totals[node_index], totals[0],
+			EXCIMER_LOG_FG_XPAD + offsets[node_index] * scale,
+			(double)(height - EXCIMER_LOG_FG_YPAD2
+				- (zend_long)(depths[node_index] + 1) * EXCIMER_LOG_FG_FRAME_HEIGHT),
+			totals[node_index] * scale);
+		excimer_log_output_check(out);
+	}
+	smart_str_appends(ss, "</svg>\n");
+
+	zend_string_release(root_name);
+	if (items) {
+		efree(items);
+	}
+	efree(visible);
+	efree(depths);
+	efree(offsets);
+	efree(totals);
+	excimer_log_path_tree_destroy(&tree);
+	excimer_log_free_function_names(log, names);
+}
+
+zend_string *excimer_log_format_flame_graph(excimer_log *log,
+	const excimer_log_flame_graph_options *options)
+{
+	excimer_log_output out;
+	excimer_log_output_init(&out, NULL);
+	excimer_log_output_flame_graph(log, &out, options);
+	return excimer_log_output_to_string(&out);
+}
+
+int excimer_log_write_flame_graph(excimer_log *log,
+	const excimer_log_flame_graph_options *options, php_stream *stream)
+{
+	excimer_log_output out;
+	excimer_log_output_init(&out, stream);
+	excimer_log_output_flame_graph(log, &out, options);
+	return excimer_log_output_close(&out);
+}
+
+/* }}} */
+
+HashTable *excimer_log_frame_to_array(excimer_log *log, excimer_log_frame *frame) {
+	HashTable *ht_func = excimer_log_new_array(0);
+	excimer_log_function *function = &log->functions[frame->function_index];
+	zval tmp;
+
+	if (function->filename) {
+		ZVAL_STR_COPY(&tmp, function->filename);
 		zend_hash_add_new(ht_func, excimer_log_known_string(ZEND_STR_FILE), &tmp);
-		/* Don't include the line number since it causes speedscope to split functions */
+		ZVAL_LONG(&tmp, frame->lineno);
+		zend_hash_add_new(ht_func, excimer_log_known_string(ZEND_STR_LINE), &tmp);
+	}
+
+	if (function->class_name) {
+		ZVAL_STR_COPY(&tmp, function->class_name);
+		zend_hash_add_new(ht_func, excimer_log_known_string(ZEND_STR_CLASS), &tmp);
+	}
+
+	if (function->function_name) {
+		ZVAL_STR_COPY(&tmp, function->function_name);
+		zend_hash_add_new(ht_func, excimer_log_known_string(ZEND_STR_FUNCTION), &tmp);
+	}
+
+	if (function->closure_line) {
+		zend_string *s = zend_string_init("closure_line", sizeof("closure_line") - 1, 0);
+		ZVAL_LONG(&tmp, function->closure_line);
+		zend_hash_add_new(ht_func, s, &tmp);
+		zend_string_delref(s);
+	}
+
+	return ht_func;
+}
+
+HashTable *excimer_log_trace_to_array(excimer_log *log, zend_long l_frame_index)
+{
+	HashTable *ht_trace = excimer_log_new_array(0);
+	uint32_t frame_index = excimer_safe_uint32(l_frame_index);
+	while (frame_index) {
+		excimer_log_frame *frame = excimer_log_get_frame(log, frame_index);
+		HashTable *ht_func = excimer_log_frame_to_array(log, frame);
+		zval tmp;
+
+		ZVAL_ARR(&tmp, ht_func);
+		zend_hash_next_index_insert(ht_trace, &tmp);
+
+		frame_index = frame->prev_index;
+	}
+
+	return ht_trace;
+}
+/**
+ * The statistics of a function name or line in excimer_log_aggregate()
+ */
+typedef struct {
+	/** The sort key */
+	zend_long inclusive;
+	/** The order in which the ID was first seen, for a stable sort */
+	uint32_t order;
+	/** The name or line ID */
+	uint32_t id;
+} excimer_log_aggr_sort_item;
+
+static int excimer_log_aggr_compare(const void *a, const void *b)
+{
+	const excimer_log_aggr_sort_item *item_a = a;
+	const excimer_log_aggr_sort_item *item_b = b;
+
+	if (item_a->inclusive != item_b->inclusive) {
+		return item_a->inclusive > item_b->inclusive ? -1 : 1;
+	}
+	return item_a->order < item_b->order ? -1 : 1;
+}
+
+static void excimer_log_aggr_swap(void *a, void *b)
+{
+	excimer_log_aggr_sort_item tmp = *(excimer_log_aggr_sort_item*)a;
+	*(excimer_log_aggr_sort_item*)a = *(excimer_log_aggr_sort_item*)b;
+	*(excimer_log_aggr_sort_item*)b = tmp;
+}
+
+/**
+ * The result of excimer_log_aggregate()
+ */
+typedef struct {
+	/** The self event count, indexed by ID */
+	zend_long *self;
+	/** The inclusive event count, indexed by ID */
+	zend_long *inclusive;
+	/** The first frame seen with each ID, indexed by ID */
+	uint32_t *first_frame;
+	/** The IDs which were seen, in descending order by inclusive count */
+	excimer_log_aggr_sort_item *items;
+	uint32_t num_items;
+	/** The total event count of the samples */
+	zend_long total;
+} excimer_log_aggr_result;
+
+/**
+ * Count the self and inclusive events of each ID, in a single pass over the
+ * samples. An ID which appears more than once in a stack, for example due to
+ * recursion, is counted once in its inclusive total.
+ *
+ * @param log The log object
+ * @param frame_ids The ID of each frame, indexed by frame index. IDs start
+ *   from 1.
+ * @param num_ids The number of IDs
+ * @param result The result, to be freed with excimer_log_aggr_result_destroy()
+ */
+static void excimer_log_aggregate(excimer_log *log, uint32_t *frame_ids,
+	uint32_t num_ids, excimer_log_aggr_result *result)
+{
+	uint32_t *visited;
+	uint32_t generation = 0;
+	uint32_t i;
+	size_t pos = 0;
+	uint32_t frame_index;
+	zend_long event_count;
+
+	/* Arrays indexed by ID */
+	result->self = ecalloc(num_ids + 1, sizeof(zend_long));
+	result->inclusive = ecalloc(num_ids + 1, sizeof(zend_long));
+	result->first_frame = ecalloc(num_ids + 1, sizeof(uint32_t));
+	result->items = safe_emalloc(num_ids + 1, sizeof(excimer_log_aggr_sort_item), 0);
+	result->num_items = 0;
+	result->total = 0;
+	visited = ecalloc(num_ids + 1, sizeof(uint32_t));
+
+	while (excimer_log_next_sample(log, &pos, &frame_index, &event_count)) {
+		int is_top = 1;
+
+		result->total += event_count;
+
+		/* The visited array contains the generation in which each ID was
+		 * last counted, so it does not need to be cleared for each sample */
+		if (++generation == 0) {
+			memset(visited, 0, (num_ids + 1) * sizeof(uint32_t));
+			generation = 1;
+		}
+
+		while (frame_index) {
+			excimer_log_frame *frame = &log->frames[frame_index];
+			uint32_t id = frame_ids[frame_index];
+
+			/* The first frame seen with this ID provides the frame info */
+			if (!result->first_frame[id]) {
+				result->first_frame[id] = frame_index;
+				result->items[result->num_items].order = result->num_items;
+				result->items[result->num_items].id = id;
+				result->num_items++;
+			}
+
+			/* If this is the top frame of a log entry, increment "self" */
+			if (is_top) {
+				result->self[id] += event_count;
+			}
+
+			/* If this is the first instance of the ID in an entry, i.e.
+			 * counting recursive functions only once, increment "inclusive" */
+			if (visited[id] != generation) {
+				visited[id] = generation;
+				result->inclusive[id] += event_count;
+			}
+
+			is_top = 0;
+			frame_index = frame->prev_index;
+		}
 	}
-	return ht_func;
+	efree(visited);
+
+	/* Sort in descending order by inclusive */
+	for (i = 0; i < result->num_items; i++) {
+		result->items[i].inclusive = result->inclusive[result->items[i].id];
+	}
+	zend_sort(result->items, result->num_items, sizeof(excimer_log_aggr_sort_item),
+		excimer_log_aggr_compare, excimer_log_aggr_swap);
 }
 
-static zend_string *excimer_log_get_speedscope_frame_key(excimer_log_frame *frame) {
-	smart_str ss = {NULL};
-	
-	excimer_log_append_frame_name(&ss, frame);
-	smart_str_appendc(&ss, '\0');
-	smart_str_append(&ss, frame->filename);
-	return excimer_log_smart_str_extract(&ss);
+static void excimer_log_aggr_result_destroy(excimer_log_aggr_result *result)
+{
+	efree(result->items);
+	efree(result->first_frame);
+	efree(result->inclusive);
+	efree(result->self);
 }
 
-static uint32_t excimer_log_count_frames(excimer_log *log, uint32_t frame_index) {
-	uint32_t n = 0;
-	while (frame_index) {
-		n++;
-		frame_index = log->frames[frame_index].prev_index;
+HashTable *excimer_log_aggr_by_func(excimer_log *log,
+	const excimer_log_prune_options *options)
+{
+	HashTable *ht_result;
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t num_names;
+	uint32_t *name_ids = excimer_log_get_name_ids(log, names, 0, &num_names);
+	uint32_t *frame_ids = ecalloc(log->frames_size, sizeof(uint32_t));
+	excimer_log_aggr_result result;
+	uint32_t i;
+	zend_long min_count, pruned_self = 0, pruned_inclusive = 0;
+
+	for (i = 1; i < log->frames_size; i++) {
+		frame_ids[i] = name_ids[log->frames[i].function_index];
 	}
-	return n;
+	excimer_log_aggregate(log, frame_ids, num_names, &result);
+	efree(frame_ids);
+
+	/* Build the result. Functions below the pruning threshold are merged
+	 * into a synthetic excimer_pruned function. Its inclusive count is the
+	 * largest of theirs, which is a lower bound. */
+	min_count = excimer_log_get_prune_threshold(options, result.total);
+	ht_result = excimer_log_new_array(result.num_items);
+	for (i = 0; i < result.num_items; i++) {
+		uint32_t name_id = result.items[i].id;
+		excimer_log_frame *frame = &log->frames[result.first_frame[name_id]];
+		zval z_info;
+
+		if (result.inclusive[name_id] < min_count) {
+			pruned_self += result.self[name_id];
+			if (result.inclusive[name_id] > pruned_inclusive) {
+				pruned_inclusive = result.inclusive[name_id];
+			}
+			continue;
+		}
+		ZVAL_ARR(&z_info, excimer_log_frame_to_array(log, frame));
+		add_assoc_long(&z_info, "self", result.self[name_id]);
+		add_assoc_long(&z_info, "inclusive", result.inclusive[name_id]);
+		zend_hash_add_new(ht_result, names[frame->function_index], &z_info);
+	}
+	if (pruned_inclusive) {
+		zval z_info;
+
+		array_init(&z_info);
+		add_assoc_string(&z_info, "file", (char*)excimer_log_fake_filename);
+		add_assoc_string(&z_info, "function", (char*)excimer_log_pruned_name);
+		add_assoc_long(&z_info, "self", pruned_self);
+		add_assoc_long(&z_info, "inclusive", pruned_inclusive);
+		zend_hash_str_update(ht_result,
+			excimer_log_pruned_name, sizeof(excimer_log_pruned_name) - 1, &z_info);
+	}
+
+	excimer_log_aggr_result_destroy(&result);
+	efree(name_ids);
+	excimer_log_free_function_names(log, names);
+	return ht_result;
 }
 
-void excimer_log_get_speedscope_data(excimer_log *log, zval *zp_data) {
-	array_init(zp_data);
-	add_assoc_string(zp_data, "$schema", "https://www.speedscope.app/file-format-schema.json");
-	add_assoc_string(zp_data, "exporter", "Excimer");
+/**
+ * Map each frame to a line ID, so that frames with the same file and line
+ * number share an ID. Line IDs start from 1.
+ *
+ * @param log The log object
+ * @param num_lines Destination for the number of line IDs
+ * @return An array of line IDs indexed by frame index, to be freed by the
+ *   caller
+ */
+static uint32_t *excimer_log_get_line_ids(excimer_log *log, uint32_t *num_lines)
+{
+	HashTable ht_files;
+	uint32_t *file_ids = ecalloc(log->functions_size, sizeof(uint32_t));
+	uint32_t *line_ids = ecalloc(log->frames_size, sizeof(uint32_t));
+	uint32_t *line_frames = safe_emalloc(log->frames_size, sizeof(uint32_t), 0);
+	uint32_t *table = ecalloc(EXCIMER_LOG_MIN_FRAME_TABLE_SIZE, sizeof(uint32_t));
+	uint32_t mask = EXCIMER_LOG_MIN_FRAME_TABLE_SIZE - 1;
+	zval *zp_id, z_tmp;
+	uint32_t i;
 
-	HashTable *ht_frames = excimer_log_new_array(0);
-	HashTable *ht_indexes_by_key = excimer_log_new_array(0);
-	zend_long *lp_frame_indexes = ecalloc(log->frames_size, sizeof(zend_long));
-	zend_long i;
-	zval *zp_frame_index;
-	zend_string *str_key;
-	zval z_tmp, *zp_tmp;
+	/* Give each distinct filename an ID. Functions in the same file do not
+	 * necessarily share a zend_string, so compare by value. */
+	zend_hash_init(&ht_files, 8, NULL, NULL, 0);
+	for (i = 1; i < log->functions_size; i++) {
+		zend_string *filename = log->functions[i].filename;
+		if (!filename) {
+			continue;
+		}
+		zp_id = zend_hash_find(&ht_files, filename);
+		if (!zp_id) {
+			ZVAL_LONG(&z_tmp, zend_hash_num_elements(&ht_files) + 1);
+			zp_id = zend_hash_add_new(&ht_files, filename, &z_tmp);
+		}
+		file_ids[i] = (uint32_t)Z_LVAL_P(zp_id);
+	}
+	zend_hash_destroy(&ht_files);
 
-	/* Build the frames array */
+	/* Then find the distinct (file ID, line) pairs in an open-addressing
+	 * table, sized once since there are at most as many lines as frames */
+	excimer_log_table_grow(&table, &mask, log->frames_size);
+	*num_lines = 0;
 	for (i = 1; i < log->frames_size; i++) {
-		zend_long index;
 		excimer_log_frame *frame = &log->frames[i];
-		str_key = excimer_log_get_speedscope_frame_key(frame);
-		zp_frame_index = zend_hash_find(ht_indexes_by_key, str_key);
-		if (!zp_frame_index) {
-			/* Add the frame to ht_frames */
-			index = zend_hash_num_elements(ht_frames);
-			ZVAL_ARR(&z_tmp, excimer_log_frame_to_speedscope_array(frame));
-			zend_hash_next_index_insert_new(ht_frames, &z_tmp);
-			/* Add the frame index to ht_indexes_by_key */
-			ZVAL_LONG(&z_tmp, index);
-			zp_frame_index = zend_hash_add_new(ht_indexes_by_key, str_key, &z_tmp);
+		uint32_t file_id = file_ids[frame->function_index];
+		uint32_t h = excimer_log_frame_hash(0, frame->lineno, file_id) & mask;
+		uint32_t line_id;
+
+		while ((line_id = table[h]) != 0) {
+			excimer_log_frame *other = &log->frames[line_frames[line_id]];
+			if (other->lineno == frame->lineno
+				&& file_ids[other->function_index] == file_id)
+			{
+				break;
+			}
+			h = (h + 1) & mask;
 		}
-		lp_frame_indexes[i] = Z_LVAL_P(zp_frame_index);
-		zend_string_release(str_key);
+		if (!line_id) {
+			line_id = ++*num_lines;
+			line_frames[line_id] = i;
+			table[h] = line_id;
+		}
+		line_ids[i] = line_id;
 	}
-	zend_array_destroy(ht_indexes_by_key);
 
-	/* zp_data["shared"] = ["frames" => ht_frames] */
-	zval z_shared;
-	array_init(&z_shared);
-	excimer_log_add_assoc_array(&z_shared, "frames", ht_frames);
-	add_assoc_zval(zp_data, "shared", &z_shared);
+	efree(table);
+	efree(line_frames);
+	efree(file_ids);
+	return line_ids;
+}
 
-	/* Build the samples and weights arrays */
-	HashTable *ht_samples = excimer_log_new_array(log->entries_size);
-	HashTable *ht_weights = excimer_log_new_array(log->entries_size);
-	uint64_t first_timestamp = 0;
-	uint64_t last_timestamp = 0;
-	for (i = 0; i < log->entries_size; i++) {
-		excimer_log_entry *entry = &log->entries[i];
-		uint32_t frame_index = entry->frame_index;
+HashTable *excimer_log_aggr_by_line(excimer_log *log)
+{
+	HashTable *ht_result;
+	uint32_t num_lines;
+	uint32_t *line_ids = excimer_log_get_line_ids(log, &num_lines);
+	excimer_log_aggr_result result;
+	smart_str ss = {NULL};
+	uint32_t i;
+
+	excimer_log_aggregate(log, line_ids, num_lines, &result);
+	efree(line_ids);
 
-		if (i == 0) {
-			first_timestamp = entry->timestamp;
+	ht_result = excimer_log_new_array(result.num_items);
+	for (i = 0; i < result.num_items; i++) {
+		uint32_t line_id = result.items[i].id;
+		excimer_log_frame *frame = &log->frames[result.first_frame[line_id]];
+		zend_string *filename = log->functions[frame->function_index].filename;
+		zval z_info, z_tmp;
+
+		array_init(&z_info);
+		if (filename) {
+			ZVAL_STR_COPY(&z_tmp, filename);
+		} else {
+			ZVAL_EMPTY_STRING(&z_tmp);
 		}
-		last_timestamp = entry->timestamp;
+		zend_hash_add_new(Z_ARRVAL(z_info), excimer_log_known_string(ZEND_STR_FILE), &z_tmp);
+		ZVAL_LONG(&z_tmp, frame->lineno);
+		zend_hash_add_new(Z_ARRVAL(z_info), excimer_log_known_string(ZEND_STR_LINE), &z_tmp);
+		add_assoc_long(&z_info, "self", result.self[line_id]);
+		add_assoc_long(&z_info, "inclusive", result.inclusive[line_id]);
 
-		uint32_t num_frames = excimer_log_count_frames(log, frame_index);
-		uint32_t j;
+		/* The key is "file:line" */
+		if (ss.s) {
+			ZSTR_LEN(ss.s) = 0;
+		}
+		if (filename) {
+			smart_str_append(&ss, filename);
+		}
+		smart_str_appendc(&ss, ':');
+		smart_str_append_unsigned(&ss, frame->lineno);
+		smart_str_0(&ss);
+		zend_hash_str_add_new(ht_result, ZSTR_VAL(ss.s), ZSTR_LEN(ss.s), &z_info);
+	}
 
-		/* Create the array with ZEND_HASH_FILL_PACKED. This is just a fast way
-		 * to get it into the right state, with num_frames elements. */
-		HashTable *ht_stack = excimer_log_new_array(num_frames);
-		zend_hash_extend(ht_stack, num_frames, 1);
-		ZEND_HASH_FILL_PACKED(ht_stack) {
-#if PHP_VERSION_ID < 70400
-			zval new_val;
+	smart_str_free(&ss);
+	excimer_log_aggr_result_destroy(&result);
+	return ht_result;
+}
+
+/**
+ * Make a call tree node array for a function, without the statistics
+ */
+static void excimer_log_init_call_tree_node(zval *zp_node,
+	excimer_log_function *function, zend_string *name)
+{
+	zval tmp;
+
+	array_init(zp_node);
+	ZVAL_STR_COPY(&tmp, name);
+	zend_hash_str_add_new(Z_ARRVAL_P(zp_node), "name", sizeof("name")-1, &tmp);
+	if (function->filename) {
+		ZVAL_STR_COPY(&tmp, function->filename);
+		zend_hash_add_new(Z_ARRVAL_P(zp_node), excimer_log_known_string(ZEND_STR_FILE), &tmp);
+	}
+	if (function->class_name) {
+		ZVAL_STR_COPY(&tmp, function->class_name);
+		zend_hash_add_new(Z_ARRVAL_P(zp_node), excimer_log_known_string(ZEND_STR_CLASS), &tmp);
+	}
+	if (function->function_name) {
+		ZVAL_STR_COPY(&tmp, function->function_name);
+		zend_hash_add_new(Z_ARRVAL_P(zp_node), excimer_log_known_string(ZEND_STR_FUNCTION), &tmp);
+	}
+	if (function->closure_line) {
+		add_assoc_long(zp_node, "closure_line", function->closure_line);
+	}
+}
+
+/**
+ * Convert a path tree to nested node arrays, as returned by
+ * excimer_log_get_call_tree().
+ *
+ * @param log The log object
+ * @param tree The path tree
+ * @param names The function name cache, which provides the child keys
+ * @param min_weight The minimum inclusive event count of a node
+ * @return The root node array
+ */
+static HashTable *excimer_log_path_tree_to_array(excimer_log *log,
+	excimer_log_path_tree *tree, zend_string **names, zend_long min_weight)
+{
+	zend_long *totals = excimer_log_path_tree_get_totals(tree);
+	zval *node_zvals;
+	excimer_log_aggr_sort_item *items = NULL;
+	size_t items_capacity = 0;
+	HashTable *ht_result;
+	size_t i;
+
+	/* Build the arrays bottom up. Children have higher indexes than their
+	 * parents, so in a reverse pass, the arrays of a node's children are
+	 * complete when the node is reached. Only nodes at or above the
+	 * threshold are materialized. The others are summed into an
+	 * excimer_pruned child of their parent. */
+	node_zvals = safe_emalloc(tree->size, sizeof(zval), 0);
+	for (i = tree->size; i-- > 0; ) {
+		excimer_log_path_node *node = &tree->nodes[i];
+		zval *zp_node = &node_zvals[i];
+		zval z_children;
+		zend_long pruned = 0;
+		size_t num_items = 0, j;
+		uint32_t child;
+
+		if (i && (!totals[i] || totals[i] < min_weight)) {
+			continue;
+		}
 
-			ZVAL_LONG(&new_val, 0);
-			for (j = 0; j < num_frames; j++) {
-				ZEND_HASH_FILL_ADD(&new_val);
+		for (child = node->first_child; child; child = tree->nodes[child].next_sibling) {
+			if (!totals[child]) {
+				continue;
 			}
-#else
-			for (j = 0; j < num_frames; j++) {
-				ZEND_HASH_FILL_SET_LONG(0);
-				ZEND_HASH_FILL_NEXT();
+			if (totals[child] < min_weight) {
+				pruned += totals[child];
+				continue;
 			}
-#endif
-		} ZEND_HASH_FILL_END();
+			items = excimer_log_grow(items, &items_capacity, num_items + 1,
+				sizeof(excimer_log_aggr_sort_item));
+			items[num_items].inclusive = totals[child];
+			items[num_items].order = (uint32_t)num_items;
+			items[num_items].id = child;
+			num_items++;
+		}
+		zend_sort(items, num_items, sizeof(excimer_log_aggr_sort_item),
+			excimer_log_aggr_compare, excimer_log_aggr_swap);
 
-		/* Write the values in reverse order */
-		ZEND_HASH_REVERSE_FOREACH_VAL(ht_stack, zp_tmp) {
-			ZVAL_LONG(zp_tmp, lp_frame_indexes[frame_index]);
-			frame_index = log->frames[frame_index].prev_index;
+		ZVAL_ARR(&z_children, excimer_log_new_array(num_items + (pruned ? 1 : 0)));
+		for (j = 0; j < num_items; j++) {
+			child = items[j].id;
+			zend_hash_add_new(Z_ARRVAL(z_children),
+				names[tree->nodes[child].function_index], &node_zvals[child]);
 		}
-		ZEND_HASH_FOREACH_END();
+		if (pruned) {
+			zval z_pruned, z_empty;
 
-		ZVAL_ARR(&z_tmp, ht_stack);
-		zend_hash_next_index_insert_new(ht_samples, &z_tmp);
+			array_init(&z_pruned);
+			add_assoc_stringl(&z_pruned, "name", (char*)excimer_log_pruned_name,
+				sizeof(excimer_log_pruned_name) - 1);
+			add_assoc_long(&z_pruned, "self", pruned);
+			add_assoc_long(&z_pruned, "inclusive", pruned);
+			array_init(&z_empty);
+			add_assoc_zval(&z_pruned, "children", &z_empty);
+			zend_hash_str_update(Z_ARRVAL(z_children), excimer_log_pruned_name,
+				sizeof(excimer_log_pruned_name) - 1, &z_pruned);
+		}
 
-		ZVAL_LONG(&z_tmp, entry->event_count * log->period);
-		zend_hash_next_index_insert_new(ht_weights, &z_tmp);
+		if (i) {
+			excimer_log_init_call_tree_node(zp_node,
+				&log->functions[node->function_index], names[node->function_index]);
+		} else {
+			array_init(zp_node);
+		}
+		add_assoc_long(zp_node, "self", node->count);
+		add_assoc_long(zp_node, "inclusive", totals[i]);
+		add_assoc_zval(zp_node, "children", &z_children);
 	}
+	ht_result = Z_ARRVAL(node_zvals[0]);
 
-	/* Build the profile array */
-	zval z_profile;
-	array_init(&z_profile);
-	add_assoc_string(&z_profile, "type", "sampled");
-	add_assoc_string(&z_profile, "name", "");
-	add_assoc_string(&z_profile, "unit", "nanoseconds");
-	add_assoc_long(&z_profile, "startValue", 0);
-	add_assoc_long(&z_profile, "endValue", last_timestamp - first_timestamp);
-	excimer_log_add_assoc_array(&z_profile, "samples", ht_samples);
-	excimer_log_add_assoc_array(&z_profile, "weights", ht_weights);
+	if (items) {
+		efree(items);
+	}
+	efree(node_zvals);
+	efree(totals);
+	return ht_result;
+}
 
-	/* zp_data["profiles"] = [profile] */
-	zval z_profiles;
-	array_init(&z_profiles);
-	add_next_index_zval(&z_profiles, &z_profile);
-	add_assoc_zval(zp_data, "profiles", &z_profiles);
+HashTable *excimer_log_get_call_tree(excimer_log *log, zend_long min_weight)
+{
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t *name_ids;
+	zend_long *frame_counts;
+	int frame_counts_owned;
+	excimer_log_path_tree tree;
+	HashTable *ht_result;
+
+	/* Merge frames by function name, ignoring the line number */
+	frame_counts = excimer_log_get_frame_counts(log, &frame_counts_owned);
+	name_ids = excimer_log_get_name_ids(log, names, 0, NULL);
+	efree(excimer_log_path_tree_build(log, &tree, name_ids, frame_counts));
+	efree(name_ids);
+	if (frame_counts_owned) {
+		efree(frame_counts);
+	}
 
-	efree(lp_frame_indexes);
+	ht_result = excimer_log_path_tree_to_array(log, &tree, names, min_weight);
+	excimer_log_path_tree_destroy(&tree);
+	excimer_log_free_function_names(log, names);
+	return ht_result;
 }
 
-HashTable *excimer_log_frame_to_array(excimer_log_frame *frame) {
-	HashTable *ht_func = excimer_log_new_array(0);
-	zval tmp;
+HashTable *excimer_log_get_bottom_up_tree(excimer_log *log, zend_long min_weight)
+{
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t *name_ids = excimer_log_get_name_ids(log, names, 0, NULL);
+	zend_long *frame_counts;
+	int frame_counts_owned;
+	excimer_log_path_tree tree;
+	HashTable *ht_result;
+	uint32_t i;
 
-	if (frame->filename) {
-		ZVAL_STR_COPY(&tmp, frame->filename);
-		zend_hash_add_new(ht_func, excimer_log_known_string(ZEND_STR_FILE), &tmp);
-		ZVAL_LONG(&tmp, frame->lineno);
-		zend_hash_add_new(ht_func, excimer_log_known_string(ZEND_STR_LINE), &tmp);
+	/* Insert each distinct stack with samples into the tree leaf first. The
+	 * count goes on the outermost node, so that the inclusive total of a node
+	 * is the number of events in which the stack ended with its path. */
+	frame_counts = excimer_log_get_frame_counts(log, &frame_counts_owned);
+	excimer_log_path_tree_init(&tree);
+	tree.nodes[0].count = frame_counts[0];
+	for (i = 1; i < log->frames_size; i++) {
+		uint32_t frame_index = i;
+		uint32_t node_index = 0;
+
+		if (!frame_counts[i]) {
+			continue;
+		}
+		while (frame_index) {
+			excimer_log_frame *frame = &log->frames[frame_index];
+			node_index = excimer_log_path_tree_find_or_add(&tree, node_index,
+				name_ids[frame->function_index], frame->function_index);
+			frame_index = frame->prev_index;
+		}
+		tree.nodes[node_index].count += frame_counts[i];
+	}
+	efree(name_ids);
+	if (frame_counts_owned) {
+		efree(frame_counts);
 	}
 
-	if (frame->class_name) {
-		ZVAL_STR_COPY(&tmp, frame->class_name);
-		zend_hash_add_new(ht_func, excimer_log_known_string(ZEND_STR_CLASS), &tmp);
+	ht_result = excimer_log_path_tree_to_array(log, &tree, names, min_weight);
+	excimer_log_path_tree_destroy(&tree);
+	excimer_log_free_function_names(log, names);
+	return ht_result;
+}
+
+/**
+ * Get the callers or callees of a function with their event counts. A
+ * neighbour is counted once per sample, even if the function appears more
+ * than once in the stack.
+ *
+ * @param log The log object
+ * @param function_name The function name, as in excimer_log_aggr_by_func()
+ * @param callers Non-zero to get the callers, zero to get the callees
+ * @return An array of event counts keyed by function name, in descending
+ *   order
+ */
+static HashTable *excimer_log_get_neighbours(excimer_log *log,
+	zend_string *function_name, int callers)
+{
+	HashTable *ht_result;
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t num_names;
+	uint32_t *name_ids = excimer_log_get_name_ids(log, names, 0, &num_names);
+	uint32_t target = 0;
+	zend_long *weights;
+	uint32_t *name_functions, *visited;
+	excimer_log_aggr_sort_item *items;
+	uint32_t num_items = 0;
+	uint32_t generation = 0;
+	uint32_t i;
+	size_t pos = 0;
+	uint32_t frame_index;
+	zend_long event_count;
+
+	for (i = 1; i < log->functions_size; i++) {
+		if (zend_string_equals(names[i], function_name)) {
+			target = name_ids[i];
+			break;
+		}
+	}
+	if (!target) {
+		efree(name_ids);
+		excimer_log_free_function_names(log, names);
+		return excimer_log_new_array(0);
 	}
 
-	if (frame->function_name) {
-		ZVAL_STR_COPY(&tmp, frame->function_name);
-		zend_hash_add_new(ht_func, excimer_log_known_string(ZEND_STR_FUNCTION), &tmp);
+	/* Arrays indexed by name ID */
+	weights = ecalloc(num_names + 1, sizeof(zend_long));
+	name_functions = ecalloc(num_names + 1, sizeof(uint32_t));
+	visited = ecalloc(num_names + 1, sizeof(uint32_t));
+	items = safe_emalloc(num_names + 1, sizeof(excimer_log_aggr_sort_item), 0);
+
+	while (excimer_log_next_sample(log, &pos, &frame_index, &event_count)) {
+		uint32_t inner = 0;
+
+		if (++generation == 0) {
+			memset(visited, 0, (num_names + 1) * sizeof(uint32_t));
+			generation = 1;
+		}
+
+		/* Walk from the leaf. The callee of a frame is the one visited before
+		 * it, and the caller is its parent. */
+		while (frame_index) {
+			excimer_log_frame *frame = &log->frames[frame_index];
+			uint32_t name_id = name_ids[frame->function_index];
+
+			if (name_id == target) {
+				uint32_t neighbour_function = callers
+					? (frame->prev_index
+						? log->frames[frame->prev_index].function_index : 0)
+					: inner;
+				uint32_t neighbour = name_ids[neighbour_function];
+
+				if (neighbour && visited[neighbour] != generation) {
+					visited[neighbour] = generation;
+					if (!name_functions[neighbour]) {
+						name_functions[neighbour] = neighbour_function;
+						items[num_items].order = num_items;
+						items[num_items].id = neighbour;
+						num_items++;
+					}
+					weights[neighbour] += event_count;
+				}
+			}
+			inner = frame->function_index;
+			frame_index = frame->prev_index;
+		}
 	}
 
-	if (frame->closure_line) {
-		zend_string *s = zend_string_init("closure_line", sizeof("closure_line") - 1, 0);
-		ZVAL_LONG(&tmp, frame->closure_line);
-		zend_hash_add_new(ht_func, s, &tmp);
-		zend_string_delref(s);
+	for (i = 0; i < num_items; i++) {
+		items[i].inclusive = weights[items[i].id];
 	}
+	zend_sort(items, num_items, sizeof(excimer_log_aggr_sort_item),
+		excimer_log_aggr_compare, excimer_log_aggr_swap);
 
-	return ht_func;
+	ht_result = excimer_log_new_array(num_items);
+	for (i = 0; i < num_items; i++) {
+		uint32_t id = items[i].id;
+		zval z_tmp;
+
+		ZVAL_LONG(&z_tmp, weights[id]);
+		zend_hash_add_new(ht_result, names[name_functions[id]], &z_tmp);
+	}
+
+	efree(items);
+	efree(visited);
+	efree(name_functions);
+	efree(weights);
+	efree(name_ids);
+	excimer_log_free_function_names(log, names);
+	return ht_result;
 }
 
-HashTable *excimer_log_trace_to_array(excimer_log *log, zend_long l_frame_index)
+HashTable *excimer_log_get_callers(excimer_log *log, zend_string *function_name)
 {
-	HashTable *ht_trace = excimer_log_new_array(0);
-	uint32_t frame_index = excimer_safe_uint32(l_frame_index);
-	while (frame_index) {
-		excimer_log_frame *frame = excimer_log_get_frame(log, frame_index);
-		HashTable *ht_func = excimer_log_frame_to_array(frame);
-		zval tmp;
+	return excimer_log_get_neighbours(log, function_name, 1);
+}
 
-		ZVAL_ARR(&tmp, ht_func);
-		zend_hash_next_index_insert(ht_trace, &tmp);
+HashTable *excimer_log_get_callees(excimer_log *log, zend_string *function_name)
+{
+	return excimer_log_get_neighbours(log, function_name, 0);
+}
 
-		frame_index = frame->prev_index;
+/* {{{ Differential profiles */
+
+/**
+ * Get the factor by which baseline counts are multiplied to make them
+ * comparable with the counts of the current log
+ */
+static double excimer_log_diff_scale(zend_long total, zend_long baseline_total,
+	int normalize)
+{
+	if (normalize && baseline_total) {
+		return (double)total / baseline_total;
 	}
+	return 1;
+}
 
-	return ht_trace;
+/**
+ * Get an array mapping each shared name ID to its name, which is a key of
+ * the given hashtable. The strings are borrowed from the hashtable.
+ */
+static zend_string **excimer_log_get_id_names(HashTable *ht_ids)
+{
+	zend_string **id_names = safe_emalloc(zend_hash_num_elements(ht_ids) + 1,
+		sizeof(zend_string*), 0);
+	zend_string *name;
+	zval *zp_id;
+
+	id_names[0] = NULL;
+	ZEND_HASH_FOREACH_STR_KEY_VAL(ht_ids, name, zp_id) {
+		id_names[Z_LVAL_P(zp_id)] = name;
+	} ZEND_HASH_FOREACH_END();
+	return id_names;
 }
 
 /**
- * ht[key] += term;
+ * Add the samples of a log to a path tree with shared name IDs
+ *
+ * @return The total event count of the log
  */
-static void excimer_log_array_incr(HashTable *ht, zend_string *sp_key, zend_long term)
+static zend_long excimer_log_diff_add_tree(excimer_log *log, excimer_log_path_tree *tree,
+	HashTable *ht_ids)
 {
-	zval *zp_value = zend_hash_find(ht, sp_key);
-	if (!zp_value) {
-		zval z_tmp;
-		ZVAL_LONG(&z_tmp, term);
-		zend_hash_add_new(ht, sp_key, &z_tmp);
-	} else {
-		Z_LVAL_P(zp_value) += term;
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t *name_ids = excimer_log_add_name_ids(log, names, 1, ht_ids);
+	zend_long *frame_counts;
+	int frame_counts_owned;
+	zend_long total = 0;
+	size_t i;
+
+	frame_counts = excimer_log_get_frame_counts(log, &frame_counts_owned);
+	efree(excimer_log_path_tree_add(log, tree, name_ids, frame_counts));
+	for (i = 0; i < log->frames_size; i++) {
+		total += frame_counts[i];
 	}
+	if (frame_counts_owned) {
+		efree(frame_counts);
+	}
+	efree(name_ids);
+	excimer_log_free_function_names(log, names);
+	return total;
 }
 
-#if PHP_VERSION_ID < 80000
-static int excimer_log_aggr_compare(const void *a, const void *b)
+static void excimer_log_output_diff_collapsed(excimer_log *log, excimer_log *baseline,
+	int normalize, excimer_log_output *out)
 {
-	zval *zp_a = &((Bucket*)a)->val;
-	zval *zp_b = &((Bucket*)b)->val;
-#else
-static int excimer_log_aggr_compare(Bucket *a, Bucket *b)
+	smart_str *ss_out = &out->ss;
+	HashTable ht_ids;
+	zend_string **id_names;
+	excimer_log_path_tree tree;
+	zend_long *baseline_counts;
+	size_t baseline_size;
+	zend_long total, baseline_total;
+	double scale;
+	uint32_t *stack = NULL;
+	size_t stack_size = 0, stack_capacity = 0;
+	size_t *path_lengths;
+	char *path = NULL;
+	size_t path_capacity = 0;
+	size_t i;
+	uint32_t child;
+
+	/* Put both logs in one tree, so that stacks are matched by name. The
+	 * baseline goes first, and its counts are moved aside before the
+	 * current log is added. */
+	zend_hash_init(&ht_ids, 0, NULL, NULL, 0);
+	excimer_log_path_tree_init(&tree);
+	baseline_total = excimer_log_diff_add_tree(baseline, &tree, &ht_ids);
+	baseline_size = tree.size;
+	baseline_counts = safe_emalloc(baseline_size, sizeof(zend_long), 0);
+	for (i = 0; i < baseline_size; i++) {
+		baseline_counts[i] = tree.nodes[i].count;
+		tree.nodes[i].count = 0;
+	}
+	total = excimer_log_diff_add_tree(log, &tree, &ht_ids);
+	scale = excimer_log_diff_scale(total, baseline_total, normalize);
+	id_names = excimer_log_get_id_names(&ht_ids);
+
+	/* Do a depth-first traversal as in excimer_log_output_collapsed(),
+	 * writing the baseline and current counts of each stack */
+	path_lengths = safe_emalloc(tree.size, sizeof(size_t), 0);
+	path_lengths[0] = 0;
+	stack = excimer_log_grow(stack, &stack_capacity, 1, sizeof(uint32_t));
+	stack[stack_size++] = 0;
+	while (stack_size) {
+		uint32_t node_index = stack[--stack_size];
+		excimer_log_path_node *node = &tree.nodes[node_index];
+		zend_long baseline_count = node_index < baseline_size
+			? baseline_counts[node_index] : 0;
+		size_t length = 0;
+
+		if (node_index) {
+			zend_string *name = id_names[node->name_id];
+
+			length = path_lengths[node->parent];
+			path = excimer_log_grow(path, &path_capacity, length + ZSTR_LEN(name) + 1, 1);
+			if (node->parent) {
+				path[length++] = ';';
+			}
+			memcpy(path + length, ZSTR_VAL(name), ZSTR_LEN(name));
+			length += ZSTR_LEN(name);
+			path_lengths[node_index] = length;
+		}
+
+		if (node->count || baseline_count) {
+			smart_str_appendl(ss_out, path, length);
+			smart_str_appendc(ss_out, ' ');
+			smart_str_append_long(ss_out, (zend_long)(baseline_count * scale + 0.5));
+			smart_str_appendc(ss_out, ' ');
+			smart_str_append_long(ss_out, node->count);
+			smart_str_appendc(ss_out, '\n');
+			excimer_log_output_check(out);
+		}
+
+		for (child = node->first_child; child; child = tree.nodes[child].next_sibling) {
+			stack = excimer_log_grow(stack, &stack_capacity, stack_size + 1, sizeof(uint32_t));
+			stack[stack_size++] = child;
+		}
+	}
+
+	if (stack) {
+		efree(stack);
+	}
+	if (path) {
+		efree(path);
+	}
+	efree(path_lengths);
+	efree(id_names);
+	efree(baseline_counts);
+	excimer_log_path_tree_destroy(&tree);
+	zend_hash_destroy(&ht_ids);
+}
+
+zend_string *excimer_log_format_diff_collapsed(excimer_log *log, excimer_log *baseline,
+	int normalize)
 {
-	zval *zp_a = &a->val;
-	zval *zp_b = &b->val;
-#endif
+	excimer_log_output out;
+	excimer_log_output_init(&out, NULL);
+	excimer_log_output_diff_collapsed(log, baseline, normalize, &out);
+	return excimer_log_output_to_string(&out);
+}
+
+/**
+ * An element of the array sorted by excimer_log_diff_by_func()
+ */
+typedef struct {
+	double delta;
+	uint32_t order;
+	uint32_t id;
+} excimer_log_diff_sort_item;
+
+static int excimer_log_diff_compare(const void *a, const void *b)
+{
+	const excimer_log_diff_sort_item *item_a = a;
+	const excimer_log_diff_sort_item *item_b = b;
 
-	zval *zp_a_incl = zend_hash_str_find(Z_ARRVAL_P(zp_a), "inclusive", sizeof("inclusive")-1);
-	zval *zp_b_incl = zend_hash_str_find(Z_ARRVAL_P(zp_b), "inclusive", sizeof("inclusive")-1);
+	if (item_a->delta != item_b->delta) {
+		return item_a->delta > item_b->delta ? -1 : 1;
+	}
+	return item_a->order < item_b->order ? -1 : 1;
+}
 
-	return ZEND_NORMALIZE_BOOL(Z_LVAL_P(zp_b_incl) - Z_LVAL_P(zp_a_incl));
+static void excimer_log_diff_swap(void *a, void *b)
+{
+	excimer_log_diff_sort_item tmp = *(excimer_log_diff_sort_item*)a;
+	*(excimer_log_diff_sort_item*)a = *(excimer_log_diff_sort_item*)b;
+	*(excimer_log_diff_sort_item*)b = tmp;
 }
 
-HashTable *excimer_log_aggr_by_func(excimer_log *log)
+/**
+ * Get the shared name IDs of the functions of a log, for
+ * excimer_log_diff_by_func()
+ */
+static uint32_t *excimer_log_diff_get_name_ids(excimer_log *log, HashTable *ht_ids)
 {
-	HashTable *ht_result = excimer_log_new_array(0);
-	zend_string *sp_inclusive = zend_string_init("inclusive", sizeof("inclusive")-1, 0);
-	zend_string *sp_self = zend_string_init("self", sizeof("self")-1, 0);
-	HashTable *ht_unique_names = excimer_log_new_array(0);
-	size_t entry_index;
-	zval z_zero;
+	zend_string **names = ecalloc(log->functions_size, sizeof(zend_string*));
+	uint32_t *name_ids = excimer_log_add_name_ids(log, names, 0, ht_ids);
 
-	ZVAL_LONG(&z_zero, 0);
+	excimer_log_free_function_names(log, names);
+	return name_ids;
+}
 
-	for (entry_index = 0; entry_index < log->entries_size; entry_index++) {
-		excimer_log_entry *entry = excimer_log_get_entry(log, entry_index);
-		uint32_t frame_index = entry->frame_index;
-		int is_top = 1;
+/**
+ * Aggregate a log by function name using shared name IDs
+ *
+ * @param log The log object
+ * @param name_ids The shared name ID of each function
+ * @param num_ids The total number of shared names
+ * @param result The result, to be freed with excimer_log_aggr_result_destroy()
+ */
+static void excimer_log_diff_aggregate(excimer_log *log, uint32_t *name_ids,
+	uint32_t num_ids, excimer_log_aggr_result *result)
+{
+	uint32_t *frame_ids = ecalloc(log->frames_size, sizeof(uint32_t));
+	uint32_t i;
 
-		while (frame_index) {
-			excimer_log_frame *frame = excimer_log_get_frame(log, frame_index);
-			smart_str ss_name = {NULL};
-			zend_string *sp_name;
-			zval *zp_info;
-			zval z_tmp;
+	for (i = 1; i < log->frames_size; i++) {
+		frame_ids[i] = name_ids[log->frames[i].function_index];
+	}
+	excimer_log_aggregate(log, frame_ids, num_ids, result);
+	efree(frame_ids);
+}
 
-			/* Make a human-readable name */
-			if (frame->closure_line != 0) {
-				/* Annotate anonymous functions with their source location.
-				 * Example: {closure:/path/to/file.php(123)}
-				 */
-				smart_str_appends(&ss_name, "{closure:");
-				smart_str_append(&ss_name, frame->filename);
-				excimer_log_smart_str_append_printf(&ss_name, "(%d)}", frame->closure_line);
-			} else if (frame->function_name == NULL) {
-				/* For file-scope code, use the file name */
-				smart_str_append(&ss_name, frame->filename);
-			} else {
-				if (frame->class_name) {
-					smart_str_append(&ss_name, frame->class_name);
-					smart_str_appends(&ss_name, "::");
-				}
-				smart_str_append(&ss_name, frame->function_name);
-			}
-			sp_name = excimer_log_smart_str_extract(&ss_name);
-
-			/* If it is not in ht_result, add it, along with frame info */
-			zp_info = zend_hash_find(ht_result, sp_name);
-			if (!zp_info) {
-				ZVAL_ARR(&z_tmp, excimer_log_frame_to_array(frame));
-				zend_hash_add_new(Z_ARRVAL(z_tmp), sp_self, &z_zero);
-				zend_hash_add_new(Z_ARRVAL(z_tmp), sp_inclusive, &z_zero);
-				zp_info = zend_hash_add(ht_result, sp_name, &z_tmp);
-			}
+HashTable *excimer_log_diff_by_func(excimer_log *log, excimer_log *baseline,
+	int normalize)
+{
+	HashTable *ht_result;
+	HashTable ht_ids;
+	zend_string **id_names;
+	uint32_t *name_ids, *baseline_name_ids;
+	uint32_t num_ids;
+	excimer_log_aggr_result result, baseline_result;
+	excimer_log_diff_sort_item *items;
+	uint32_t num_items = 0;
+	double scale;
+	uint32_t i;
 
-			/* If this is the top frame of a log entry, increment the "self" key */
-			if (is_top) {
-				excimer_log_array_incr(Z_ARRVAL_P(zp_info), sp_self, entry->event_count);
-			}
+	/* Map the names of both logs before aggregating, so that the result
+	 * arrays have an element for every shared ID */
+	zend_hash_init(&ht_ids, 0, NULL, NULL, 0);
+	baseline_name_ids = excimer_log_diff_get_name_ids(baseline, &ht_ids);
+	name_ids = excimer_log_diff_get_name_ids(log, &ht_ids);
+	num_ids = zend_hash_num_elements(&ht_ids);
 
-			/* If this is the first instance of a function in an entry, i.e.
-			 * counting recursive functions only once, increment the "inclusive" key */
-			if (zend_hash_find(ht_unique_names, sp_name) == NULL) {
-				excimer_log_array_incr(Z_ARRVAL_P(zp_info), sp_inclusive, entry->event_count);
-				/* Add the function to the unique_names array */
-				zend_hash_add_new(ht_unique_names, sp_name, &z_zero);
-			}
+	excimer_log_diff_aggregate(baseline, baseline_name_ids, num_ids, &baseline_result);
+	excimer_log_diff_aggregate(log, name_ids, num_ids, &result);
+	efree(baseline_name_ids);
+	efree(name_ids);
+	scale = excimer_log_diff_scale(result.total, baseline_result.total, normalize);
+	id_names = excimer_log_get_id_names(&ht_ids);
 
-			is_top = 0;
-			frame_index = frame->prev_index;
-			zend_string_delref(sp_name);
+	/* Sort by the change in inclusive count, largest increase first */
+	items = safe_emalloc(num_ids + 1, sizeof(excimer_log_diff_sort_item), 0);
+	for (i = 1; i <= num_ids; i++) {
+		if (!result.first_frame[i] && !baseline_result.first_frame[i]) {
+			continue;
 		}
-		zend_hash_clean(ht_unique_names);
+		items[num_items].delta = result.inclusive[i]
+			- baseline_result.inclusive[i] * scale;
+		items[num_items].order = num_items;
+		items[num_items].id = i;
+		num_items++;
 	}
-	zend_hash_destroy(ht_unique_names);
-	zend_string_delref(sp_self);
-	zend_string_delref(sp_inclusive);
+	zend_sort(items, num_items, sizeof(excimer_log_diff_sort_item),
+		excimer_log_diff_compare, excimer_log_diff_swap);
 
-	/* Sort the result in descending order by inclusive */
-	zend_hash_sort(ht_result, excimer_log_aggr_compare, 0);
+	ht_result = excimer_log_new_array(num_items);
+	for (i = 0; i < num_items; i++) {
+		uint32_t id = items[i].id;
+		zval z_info;
+
+		/* Take the frame info from the current log if possible */
+		if (result.first_frame[id]) {
+			ZVAL_ARR(&z_info, excimer_log_frame_to_array(log,
+				&log->frames[result.first_frame[id]]));
+		} else {
+			ZVAL_ARR(&z_info, excimer_log_frame_to_array(baseline,
+				&baseline->frames[baseline_result.first_frame[id]]));
+		}
+		add_assoc_long(&z_info, "self", result.self[id]);
+		add_assoc_long(&z_info, "inclusive", result.inclusive[id]);
+		add_assoc_long(&z_info, "baseline_self", baseline_result.self[id]);
+		add_assoc_long(&z_info, "baseline_inclusive", baseline_result.inclusive[id]);
+		add_assoc_double(&z_info, "self_delta",
+			result.self[id] - baseline_result.self[id] * scale);
+		add_assoc_double(&z_info, "inclusive_delta", items[i].delta);
+		zend_hash_add_new(ht_result, id_names[id], &z_info);
+	}
 
+	efree(items);
+	efree(id_names);
+	excimer_log_aggr_result_destroy(&result);
+	excimer_log_aggr_result_destroy(&baseline_result);
+	zend_hash_destroy(&ht_ids);
 	return ht_result;
 }
+
+/* }}} */
@@ -17,21 +17,25 @@
 #define EXCIMER_LOG_H
 
 /**
- * Structure representing a unique location in the code and its backtrace
+ * Structure representing a unique function. Interned strings are borrowed,
+ * other strings are referenced from excimer_log.owned_strings.
  */
-typedef struct _excimer_log_frame {
+typedef struct _excimer_log_function {
 	/** The filename, or may be fake e.g. "php shell code" */
 	zend_string *filename;
 
-	/** The executing line number within the filename */
-	uint32_t lineno;
-
 	/**
 	 * If the function was a closure, the "start line" of its definition.
 	 * Zero if the function was not a closure.
 	 */
 	uint32_t closure_line;
 
+	/**
+	 * The line at which the function definition starts, or zero if it is
+	 * unknown. This is not part of the key in the function table.
+	 */
+	uint32_t start_line;
+
 	/** The class name, or NULL if there was no class name. */
 	zend_string *class_name;
 
@@ -40,6 +44,17 @@ typedef struct _excimer_log_frame {
 	 * fake thing like "eval()'d code".
 	 */
 	zend_string *function_name;
+} excimer_log_function;
+
+/**
+ * Structure representing a unique location in the code and its backtrace
+ */
+typedef struct _excimer_log_frame {
+	/** The index within excimer_log.functions of the executing function */
+	uint32_t function_index;
+
+	/** The executing line number within the filename */
+	uint32_t lineno;
 
 	/**
 	 * The index within excimer_log.frames of the calling frame.
@@ -64,10 +79,69 @@ typedef struct _excimer_log_entry {
 	/**
 	 * The wall clock time at which the event occurred. The interpretation is
 	 * caller-defined, but in Excimer it is the number of nanoseconds since boot.
+	 * If samples were merged into this entry, this is the time of the first
+	 * sample.
 	 */
 	uint64_t timestamp;
+
+	/**
+	 * The time of the last sample merged into this entry. This is equal to
+	 * the timestamp if sample_count is 1.
+	 */
+	uint64_t end_timestamp;
+
+	/**
+	 * The number of consecutive samples with the same frame index which were
+	 * merged into this entry.
+	 */
+	uint32_t sample_count;
 } excimer_log_entry;
 
+/**
+ * Structure representing an element of the function cache, which maps a
+ * zend_function to a function index without hashing any strings.
+ */
+typedef struct _excimer_log_function_cache_entry {
+	/** The zend_function, or NULL if the element is empty */
+	zend_function *func;
+
+	/**
+	 * The opcodes and scope of the zend_function at the time it was cached.
+	 * These are compared as well as the zend_function pointer, in case the
+	 * zend_function was freed and its memory reused, or a closure was
+	 * rebound to a different scope.
+	 */
+	const zend_op *opcodes;
+	zend_class_entry *scope;
+
+	/** The function index */
+	uint32_t function_index;
+} excimer_log_function_cache_entry;
+
+/**
+ * Structure representing one level of the most recently captured backtrace,
+ * used to avoid resolving frames again if they did not change.
+ */
+typedef struct _excimer_log_stack_level {
+	/** The VM frame */
+	zend_execute_data *execute_data;
+
+	/** The function which was executing in the VM frame */
+	zend_function *func;
+
+	/** The current opline of the VM frame */
+	const zend_op *opline;
+
+	/**
+	 * The filename of the user function, borrowed from the function table,
+	 * or NULL if the function was not user code
+	 */
+	zend_string *filename;
+
+	/** The frame index which the VM frame resolved to */
+	uint32_t frame_index;
+} excimer_log_stack_level;
+
 /**
  * Structure representing the entire log
  */
@@ -75,21 +149,151 @@ typedef struct _excimer_log {
 	/** Array of log entries */
 	excimer_log_entry *entries;
 
-	/** Size of the "entries" array */
+	/** Number of used elements in the "entries" array */
 	size_t entries_size;
 
+	/** Number of allocated elements in the "entries" array */
+	size_t entries_capacity;
+
+	/**
+	 * If this is non-zero, the log is a ring buffer: the "entries" array has
+	 * exactly this many elements, and once it is full, adding an entry
+	 * overwrites the oldest entry.
+	 */
+	size_t ring_capacity;
+
+	/**
+	 * The index in the "entries" array of the oldest entry. This is always
+	 * zero unless the log is a full ring buffer.
+	 */
+	size_t entries_head;
+
 	/** Array of frames */
 	excimer_log_frame *frames;
 
-	/* Size of the "frames" array */
+	/* Number of used elements in the "frames" array */
 	size_t frames_size;
 
+	/** Number of allocated elements in the "frames" array */
+	size_t frames_capacity;
+
+	/** Array of functions. Element zero is unused. */
+	excimer_log_function *functions;
+
+	/** Number of used elements in the "functions" array */
+	size_t functions_size;
+
+	/** Number of allocated elements in the "functions" array */
+	size_t functions_capacity;
+
+	/**
+	 * The non-interned strings referenced by the functions array, each of
+	 * which holds a reference that is released when the log is destroyed.
+	 */
+	zend_string **owned_strings;
+
+	/** Number of used elements in the "owned_strings" array */
+	size_t owned_strings_size;
+
+	/** Number of allocated elements in the "owned_strings" array */
+	size_t owned_strings_capacity;
+
+	/**
+	 * If this is non-zero, new samples are not stored as entries. Instead,
+	 * their event counts are added to frame_counts.
+	 */
+	int aggregate;
+
+	/**
+	 * The aggregated event count of each leaf frame, indexed by frame index,
+	 * or NULL if no samples have been aggregated.
+	 */
+	zend_long *frame_counts;
+
+	/**
+	 * Number of allocated elements in the "frame_counts" array. All
+	 * allocated elements are initialised.
+	 */
+	size_t frame_counts_capacity;
+
+	/** The number of samples added to frame_counts */
+	size_t aggregated_samples;
+
+	/**
+	 * If this is non-zero, a sample with the same frame index as the most
+	 * recent entry is merged into that entry instead of creating a new one.
+	 */
+	int merge_runs;
+
+	/**
+	 * The number of samples which were merged into an existing entry, i.e.
+	 * the sum of sample_count - 1 over all entries.
+	 */
+	size_t merged_samples;
+
+	/**
+	 * The number of entries and frames requested with excimer_log_reserve().
+	 * These are copied to the new log on rotation.
+	 */
+	size_t reserved_entries;
+	size_t reserved_frames;
+
+	/**
+	 * An open-addressing hashtable used for deduplication of frames. Each
+	 * slot contains a frame index, or zero if the slot is empty. The key is
+	 * the function index, line number and previous frame index of the frame
+	 * at that index.
+	 */
+	uint32_t *frame_table;
+
+	/** The size of frame_table minus one. The size is a power of two. */
+	uint32_t frame_table_mask;
+
+	/**
+	 * An open-addressing hashtable used for deduplication of functions,
+	 * like frame_table. The key is the filename, class name, function name
+	 * and closure line.
+	 */
+	uint32_t *function_table;
+
+	/** The size of function_table minus one. The size is a power of two. */
+	uint32_t function_table_mask;
+
+	/** The index of the fake frame marking a truncated backtrace, or zero */
+	uint32_t truncated_frame_index;
+
+	/**
+	 * A direct-mapped cache of function indexes, indexed by a hash of the
+	 * zend_function pointer. This is allocated when it is first needed.
+	 */
+	excimer_log_function_cache_entry *function_cache;
+
+	/**
+	 * The levels of the most recently captured backtrace, starting from the
+	 * outermost VM frame.
+	 */
+	excimer_log_stack_level *stack;
+
+	/** The number of valid elements in the "stack" array */
+	size_t stack_size;
+
+	/** The number of allocated elements in the "stack" array */
+	size_t stack_capacity;
+
+	/**
+	 * The parent frame index of the outermost level in the "stack" array.
+	 * This is either zero or the truncation marker.
+	 */
+	uint32_t stack_base;
+
 	/**
-	 * A hashtable where the key is a unique frame identifier combining some
-	 * elements of the frame object, and the value is the frame index. Used
-	 * for deduplication of frames.
+	 * Scratch buffer holding the VM frames of the backtrace being captured,
+	 * starting from the innermost frame.
 	 */
-	HashTable *reverse_frames;
+	zend_execute_data **walk_buffer;
+
+	/** The number of allocated elements in the "walk_buffer" array */
+	size_t walk_capacity;
 
 	/**
 	 * The maximum stack depth of collected frames. If this is exceeded, the
@@ -112,6 +316,31 @@ typedef struct _excimer_log {
 	 * The sum of the event counts of all contained log entries
 	 */
 	zend_long event_count;
+
+	/**
+	 * The number of entries which have been removed from the start of the
+	 * log, by being overwritten in a ring buffer or by a reduction of the
+	 * ring capacity. Adding this to an entry index gives an absolute index
+	 * which does not change when older entries are removed.
+	 */
+	uint64_t entries_base;
+
+	/**
+	 * If this is a view created by excimer_log_slice(), the log which owns
+	 * its entries, frames and functions. The view borrows these arrays, so
+	 * excimer_log_sync_view() must be called before each use of the view,
+	 * in case the parent has reallocated them.
+	 */
+	struct _excimer_log *parent;
+
+	/** For a view, the absolute index in the parent of the first entry */
+	uint64_t view_start;
+
+	/** For a view, the absolute index in the parent after the last entry */
+	uint64_t view_end;
+
+	/** For a view, the event count of the parent when it was last synced */
+	zend_long view_parent_event_count;
 } excimer_log;
 
 /**
@@ -137,6 +366,49 @@ void excimer_log_destroy(excimer_log *log);
  */
 void excimer_log_set_max_depth(excimer_log *log, zend_long depth);
 
+/**
+ * Preallocate storage for the given number of entries and frames, so that
+ * the arrays do not need to be grown while the profiler is running.
+ *
+ * @param log The log object
+ * @param entries The number of entries
+ * @param frames The number of frames
+ */
+void excimer_log_reserve(excimer_log *log, size_t entries, size_t frames);
+
+/**
+ * Set the ring buffer capacity. If the capacity is non-zero, only the most
+ * recent entries, up to the given number, will be kept. Existing entries
+ * beyond the capacity are discarded, oldest first. If the capacity is zero,
+ * the log will grow without limit.
+ *
+ * @param log The log object
+ * @param capacity The maximum number of entries, or zero for no limit
+ */
+void excimer_log_set_ring_capacity(excimer_log *log, size_t capacity);
+
+/**
+ * Enable or disable aggregate mode. In aggregate mode, samples are not
+ * stored as entries with a timestamp, instead the event count of the leaf
+ * frame is incremented. Entries and aggregated counts which are already in
+ * the log are kept.
+ *
+ * @param log The log object
+ * @param aggregate Non-zero to enable aggregate mode
+ */
+void excimer_log_set_aggregate(excimer_log *log, int aggregate);
+
+/**
+ * Enable or disable run-length encoding. When enabled, a sample with the
+ * same stack as the most recent entry, which follows it without a gap, is
+ * merged into that entry by updating its end timestamp, sample count and
+ * event count.
+ *
+ * @param log The log object
+ * @param merge_runs Non-zero to enable merging
+ */
+void excimer_log_set_merge_runs(excimer_log *log, int merge_runs);
+
 /**
  * Copy persistent options to another log. This is used during log rotation.
  *
@@ -164,6 +436,26 @@ void excimer_log_add(excimer_log *log, zend_execute_data *execute_data,
  */
 zend_long excimer_log_get_size(excimer_log *log);
 
+/**
+ * Get the number of samples which have been added to the log, including
+ * samples which were aggregated rather than stored as entries.
+ *
+ * @param log The log object
+ * @return The number of samples
+ */
+zend_long excimer_log_get_sample_count(excimer_log *log);
+
+/**
+ * Get the estimated time of one of the samples merged into an entry. The
+ * first and last sample times are exact. Samples in between are assumed to
+ * have been evenly spaced.
+ *
+ * @param entry The log entry
+ * @param i The sample index, from 0 to entry->sample_count - 1
+ * @return The timestamp
+ */
+uint64_t excimer_log_get_sample_timestamp(excimer_log_entry *entry, uint32_t i);
+
 /**
  * Get a log entry
  *
@@ -173,6 +465,37 @@ zend_long excimer_log_get_size(excimer_log *log);
  */
 excimer_log_entry *excimer_log_get_entry(excimer_log *log, zend_long i);
 
+/**
+ * Get the absolute index of the first entry in the log. Adding an entry's
+ * index to this gives an identifier which remains valid, and continues to
+ * refer to the same entry, when older entries are removed.
+ *
+ * @param log The log object
+ * @return The absolute index
+ */
+uint64_t excimer_log_get_entries_base(excimer_log *log);
+
+/**
+ * Initialise a log as a view of the entries of another log with timestamps
+ * in a given range. The view shares the entries, frames and functions of the
+ * log which owns them, without copying. The owning log must outlive the view,
+ * and it must not be destroyed before the view.
+ *
+ * @param view A newly initialised log which will become the view
+ * @param log The log to slice, which may itself be a view
+ * @param start The start timestamp, inclusive
+ * @param end The end timestamp, exclusive
+ */
+void excimer_log_slice(excimer_log *view, excimer_log *log, uint64_t start, uint64_t end);
+
+/**
+ * Update a view to reflect any reallocation of the parent's arrays, or the
+ * removal of entries from a parent ring buffer.
+ *
+ * @param view The view
+ */
+void excimer_log_sync_view(excimer_log *view);
+
 /**
  * Get a frame by index
  *
@@ -182,26 +505,238 @@ excimer_log_entry *excimer_log_get_entry(excimer_log *log, zend_long i);
  */
 excimer_log_frame *excimer_log_get_frame(excimer_log *log, zend_long i);
 
+/**
+ * Get a function by index
+ *
+ * @param log The log object
+ * @param i The index
+ * @return The function, or NULL if the index is out of range
+ */
+excimer_log_function *excimer_log_get_function(excimer_log *log, zend_long i);
+
+/**
+ * Options for reducing the size of an export by pruning stacks which account
+ * for a small fraction of the events
+ */
+typedef struct {
+	/** Subtrees with less than this fraction of the total event count are
+	 * replaced by a synthetic excimer_pruned frame with their total weight */
+	double min_fraction;
+
+	/** If non-zero, the threshold is raised as necessary so that the output
+	 * fits in approximately this many bytes. Only used by text formats. */
+	size_t max_bytes;
+} excimer_log_prune_options;
+
 /**
  * Format the log in flamegraph.pl collapsed format
  *
  * @param log The log object
+ * @param options Pruning options, or NULL to include every stack
  * @return A new zend_string owned by the caller
  */
-zend_string *excimer_log_format_collapsed(excimer_log *log);
+zend_string *excimer_log_format_collapsed(excimer_log *log,
+	const excimer_log_prune_options *options);
 
 /**
  * Get an array in speedscope format
  *
  * @param log The log object
+ * @param options Pruning options, or NULL to include every sample. If
+ *   pruning is enabled, samples are aggregated by stack.
  * @param zp_data The destination
  */
-void excimer_log_get_speedscope_data(excimer_log *log, zval *zp_data);
+void excimer_log_get_speedscope_data(excimer_log *log,
+	const excimer_log_prune_options *options, zval *zp_data);
+
+/**
+ * Format the log as speedscope JSON. This produces the same data as
+ * excimer_log_get_speedscope_data(), without building an intermediate array.
+ *
+ * @param log The log object
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_format_speedscope(excimer_log *log);
+
+/**
+ * Format the log as a pprof profile.proto message. The result is gzipped if
+ * Excimer was built with zlib.
+ *
+ * @param log The log object
+ * @param time_nanos The Unix time in nanoseconds corresponding to the epoch
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_format_pprof(excimer_log *log, uint64_t time_nanos);
+
+/**
+ * Format the log in callgrind format, for KCachegrind and similar tools
+ *
+ * @param log The log object
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_format_callgrind(excimer_log *log);
+
+/**
+ * Format the log as Chrome trace event JSON, with begin and end events for
+ * each call, inferred from the stacks of consecutive samples.
+ *
+ * @param log The log object
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_format_chrome_trace(excimer_log *log);
+
+/**
+ * Format the log as a speedscope evented profile, with open and close events
+ * for each call, inferred from the stacks of consecutive samples.
+ *
+ * @param log The log object
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_format_speedscope_evented(excimer_log *log);
+
+/**
+ * Format the log as a Gecko profile, for import into the Firefox Profiler
+ *
+ * @param log The log object
+ * @param start_time The Unix time in nanoseconds corresponding to the epoch
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_format_gecko(excimer_log *log, uint64_t start_time);
+
+/**
+ * Options for excimer_log_format_flame_graph()
+ */
+typedef struct {
+	/** The image width in pixels */
+	zend_long width;
+
+	/** The minimum frame width in pixels. Narrower frames are omitted along
+	 * with their descendants. */
+	double min_width;
+
+	/** The title, or NULL for the default */
+	zend_string *title;
+} excimer_log_flame_graph_options;
+
+/**
+ * Render the log as a self-contained SVG flame graph, laid out in the same
+ * way as flamegraph.pl
+ *
+ * @param log The log object
+ * @param options The rendering options
+ * @return A new zend_string owned by the caller
+ */
+zend_string *excimer_log_format_flame_graph(excimer_log *log,
+	const excimer_log_flame_graph_options *options);
+
+/**
+ * Functions which write formatted output to a stream in chunks, instead of
+ * returning it as a string. The output is the same as the corresponding
+ * excimer_log_format_* function.
+ *
+ * @param log The log object
+ * @param stream The destination stream
+ * @return Non-zero on success, zero if writing to the stream failed
+ */
+int excimer_log_write_collapsed(excimer_log *log,
+	const excimer_log_prune_options *options, php_stream *stream);
+int excimer_log_write_speedscope(excimer_log *log, php_stream *stream);
+int excimer_log_write_pprof(excimer_log *log, uint64_t time_nanos, php_stream *stream);
+int excimer_log_write_callgrind(excimer_log *log, php_stream *stream);
+int excimer_log_write_chrome_trace(excimer_log *log, php_stream *stream);
+int excimer_log_write_speedscope_evented(excimer_log *log, php_stream *stream);
+int excimer_log_write_gecko(excimer_log *log, uint64_t start_time, php_stream *stream);
+int excimer_log_write_flame_graph(excimer_log *log,
+	const excimer_log_flame_graph_options *options, php_stream *stream);
+
+/**
+ * Aggregate the log producing self/inclusive statistics as an array.
+ * Functions below the pruning threshold in options, which may be NULL, are
+ * merged into an excimer_pruned element.
+ */
+HashTable *excimer_log_aggr_by_func(excimer_log *log,
+	const excimer_log_prune_options *options);
+
+/**
+ * Aggregate the log producing self/inclusive statistics for each source line,
+ * keyed by "file:line"
+ */
+HashTable *excimer_log_aggr_by_line(excimer_log *log);
+
+/**
+ * Get the call tree of the log, with frames merged by function, as nested
+ * arrays. Subtrees with an inclusive count below min_weight are merged into
+ * an excimer_pruned child of their parent.
+ *
+ * @param log The log object
+ * @param min_weight The minimum inclusive event count of a node
+ * @return The root node array
+ */
+HashTable *excimer_log_get_call_tree(excimer_log *log, zend_long min_weight);
+
+/**
+ * Get the bottom-up tree, which is the call tree inverted so that the
+ * children of the root are the innermost functions of each sample, and the
+ * children of other nodes are their callers. The nodes are as in
+ * excimer_log_get_call_tree().
+ *
+ * @param log The log object
+ * @param min_weight The minimum inclusive event count of a node
+ * @return The root node array
+ */
+HashTable *excimer_log_get_bottom_up_tree(excimer_log *log, zend_long min_weight);
 
 /**
- * Aggregate the log producing self/inclusive statistics as an array
+ * Get the functions which called a given function, with the number of events
+ * in which each one did so.
+ *
+ * @param log The log object
+ * @param function_name The function name, as in excimer_log_aggr_by_func()
+ * @return An array of event counts keyed by function name
+ */
+HashTable *excimer_log_get_callers(excimer_log *log, zend_string *function_name);
+
+/**
+ * Get the functions called by a given function, with the number of events
+ * in which each one was called by it.
+ *
+ * @param log The log object
+ * @param function_name The function name, as in excimer_log_aggr_by_func()
+ * @return An array of event counts keyed by function name
+ */
+HashTable *excimer_log_get_callees(excimer_log *log, zend_string *function_name);
+
+/**
+ * Compare the stacks of a log with a baseline log, in the differential
+ * collapsed format. Each line has a stack in the collapsed format, followed
+ * by the baseline event count and the current event count, separated by
+ * spaces. Stacks are matched by function name.
+ *
+ * @param log The current log
+ * @param baseline The baseline log
+ * @param normalize If non-zero, the baseline counts are scaled so that the
+ *   total event count is the same as in the current log
+ * @return The result string, owned by the caller
+ */
+zend_string *excimer_log_format_diff_collapsed(excimer_log *log, excimer_log *baseline,
+	int normalize);
+
+/**
+ * Compare the aggregated function statistics of a log with a baseline log.
+ * Each element has the keys of excimer_log_aggr_by_func(), and also
+ * baseline_self and baseline_inclusive, with the baseline counts, and
+ * self_delta and inclusive_delta, with the difference between the current
+ * and scaled baseline counts. The elements are sorted in descending order of
+ * inclusive_delta.
+ *
+ * @param log The current log
+ * @param baseline The baseline log
+ * @param normalize If non-zero, baseline counts are scaled by the ratio of
+ *   the total event counts before the deltas are computed
+ * @return An array of function statistics keyed by function name
  */
-HashTable *excimer_log_aggr_by_func(excimer_log *log);
+HashTable *excimer_log_diff_by_func(excimer_log *log, excimer_log *baseline,
+	int normalize);
 
 /**
  * Convert a frame to a backtrace array for returning to the user
@@ -29,9 +29,18 @@ class ExcimerLog implements ArrayAccess, Iterator {
 	 * giving the number of times the stack appeared. Then there is a line
 	 * break. This is repeated for each unique stack trace.
 	 *
+	 * The output can be reduced in size with these options:
+	 *
+	 *   - minFraction: Stack subtrees which account for less than this
+	 *     fraction of the events are replaced by a single "excimer_pruned"
+	 *     frame under their parent, with their combined count.
+	 *   - maxBytes: The pruning threshold is raised as necessary so that the
+	 *     output is no larger than approximately this many bytes.
+	 *
+	 * @param array $options
 	 * @return string
 	 */
-	function formatCollapsed() {
+	function formatCollapsed( array $options = [] ) {
 	}
 
 	/**
@@ -59,17 +68,354 @@ class ExcimerLog implements ArrayAccess, Iterator {
 	 * overruns. They represent an estimate of the number of profiling periods
 	 * in which those functions were present.
 	 *
+	 * If the minFraction option is given, functions with an inclusive count
+	 * below that fraction of the events are merged into a single element
+	 * with the key "excimer_pruned". Its "self" count is the sum of theirs.
+	 *
+	 * @param array $options
 	 * @return array
 	 */
-	function aggregateByFunction() {
+	function aggregateByFunction( array $options = [] ) {
+	}
+
+	/**
+	 * Produce an array with an element for every source line which appears
+	 * in the log, for example to show a heatmap of a long function. The key
+	 * is "file:line". The value is an associative array with the following
+	 * elements:
+	 *
+	 *   - file: The filename
+	 *   - line: The line number
+	 *   - self: The number of events in which this line was executing in
+	 *     the innermost userspace function.
+	 *   - inclusive: The number of events in which this line appeared
+	 *     somewhere in the stack. A line which appears more than once in a
+	 *     stack due to recursion is counted once.
+	 *
+	 * The elements are sorted in descending order of inclusive count.
+	 *
+	 * @return array
+	 */
+	function aggregateByLine() {
+	}
+
+	/**
+	 * Get the top-down call tree, with frames merged by function, ignoring
+	 * line numbers. Each node is an associative array with the following
+	 * elements:
+	 *
+	 *   - self: The number of events in which this node was the innermost
+	 *     userspace function.
+	 *   - inclusive: The number of events in this node and its descendants.
+	 *   - children: The child nodes, keyed by function name, in descending
+	 *     order of inclusive count.
+	 *
+	 * Nodes other than the root also have a "name" element, and "file",
+	 * "class", "function" and "closure_line" as in aggregateByFunction().
+	 *
+	 * Options are:
+	 *   - minWeight: Subtrees with an inclusive count below this are not
+	 *     included. Instead, their combined count is given by a child node
+	 *     of their parent named "excimer_pruned".
+	 *
+	 * @param array $options
+	 * @return array The root node
+	 */
+	function getCallTree( array $options = [] ) {
+	}
+
+	/**
+	 * Get the bottom-up tree. This is the call tree inverted, so that the
+	 * children of the root are the innermost functions of each sample, and
+	 * the children of other nodes are the callers of that node.
+	 *
+	 * The nodes are as in getCallTree(), but the inclusive count of a node
+	 * is the number of events in which the stack ended with the node's path,
+	 * that is, the self time of the innermost function when it was called
+	 * in that way. The self count is the number of events in which the whole
+	 * stack was the node's path.
+	 *
+	 * Options are as in getCallTree().
+	 *
+	 * @param array $options
+	 * @return array The root node
+	 */
+	function getBottomUpTree( array $options = [] ) {
+	}
+
+	/**
+	 * Get the functions which called a given function. The result is an
+	 * array of event counts keyed by function name, in descending order.
+	 * A caller is counted once per sample, even if the function is
+	 * recursive.
+	 *
+	 * @param string $function The function name, as in aggregateByFunction()
+	 * @return array
+	 */
+	function getCallers( $function ) {
+	}
+
+	/**
+	 * Get the functions called by a given function. The result is an array
+	 * of event counts keyed by function name, in descending order. A callee
+	 * is counted once per sample, even if the function is recursive.
+	 *
+	 * @param string $function The function name, as in aggregateByFunction()
+	 * @return array
+	 */
+	function getCallees( $function ) {
 	}
 
 	/**
 	 * Get an array which can be JSON encoded for import into speedscope
 	 *
+	 * If the minFraction option is given, stacks are pruned as in
+	 * formatCollapsed(), and the samples are aggregated into one sample per
+	 * unique stack, so the time order is lost.
+	 *
+	 * @param array $options
 	 * @return array
 	 */
-	function getSpeedscopeData() {
+	function getSpeedscopeData( array $options = [] ) {
+	}
+
+	/**
+	 * Format the log as a JSON string for import into speedscope. The result
+	 * is equivalent to json_encode( $log->getSpeedscopeData() ), but it is
+	 * written directly, without building an intermediate array, so it is
+	 * faster and uses less memory for large logs.
+	 *
+	 * @return string
+	 */
+	function formatSpeedscope() {
+	}
+
+	/**
+	 * Format the log as a pprof profile, in the profile.proto format used by
+	 * "go tool pprof" and compatible tools. If Excimer was compiled with
+	 * zlib, the result is gzip compressed, otherwise it is uncompressed.
+	 * pprof accepts either.
+	 *
+	 * Each frame is a Location with a single Line, so line numbers are
+	 * preserved. Samples with the same stack are combined. Each sample has
+	 * two values: "events", the event count, and "time", the event count
+	 * multiplied by the period in nanoseconds. The duration is the time from
+	 * the first entry to the end of the last, and is omitted if the log has
+	 * no entries.
+	 *
+	 * @return string
+	 */
+	function formatPprof() {
+	}
+
+	/**
+	 * Format the log in callgrind format, for viewing in KCachegrind or
+	 * QCachegrind. There are two events: the event count, and the event count
+	 * multiplied by the period in nanoseconds.
+	 *
+	 * Self costs are attributed to the line which was executing when the
+	 * sample was taken. Inclusive costs of a call are attributed to the line
+	 * in the caller which made the call. Since the number of calls is not
+	 * known, the "calls" count is the number of events in the callee.
+	 *
+	 * @return string
+	 */
+	function formatCallgrind() {
+	}
+
+	/**
+	 * Format the log as Chrome trace event JSON, for viewing as a timeline
+	 * in chrome://tracing or Perfetto. Calls are inferred from the stacks of
+	 * consecutive samples: a call begins at the first sample in which it is
+	 * on the stack, and ends at the first sample in which it is not.
+	 * Timestamps are in microseconds since the profiler was created.
+	 *
+	 * Samples recorded in aggregate mode have no timestamp and are omitted.
+	 *
+	 * @return string
+	 */
+	function formatChromeTrace() {
+	}
+
+	/**
+	 * Format the log as a speedscope evented profile, for viewing the calls
+	 * in time order. Calls are inferred from the stacks of consecutive
+	 * samples, as in formatChromeTrace(). Times are in nanoseconds since the
+	 * profiler was created.
+	 *
+	 * Samples recorded in aggregate mode have no timestamp and are omitted.
+	 *
+	 * @return string
+	 */
+	function formatSpeedscopeEvented() {
+	}
+
+	/**
+	 * Format the log as a Gecko profile JSON document, for viewing as a
+	 * timeline in the Firefox Profiler. Each sample is included with its
+	 * timestamp and full stack, including line numbers.
+	 *
+	 * Samples recorded in aggregate mode have no timestamp and are omitted.
+	 *
+	 * @return string
+	 */
+	function formatGeckoProfile() {
+	}
+
+	/**
+	 * Render the log as a self-contained SVG flame graph, equivalent to
+	 * passing the output of formatCollapsed() through flamegraph.pl.
+	 *
+	 * Options are:
+	 *   - width: The image width in pixels. Default 1200.
+	 *   - minWidth: The minimum frame width in pixels. Narrower frames and
+	 *     their descendants are omitted. Default 0.1.
+	 *   - title: The title text. Default "Flame Graph".
+	 *
+	 * @param array $options
+	 * @return string
+	 */
+	function renderFlameGraph( array $options = [] ) {
+	}
+
+	/**
+	 * Write the output of renderFlameGraph() to a stream in chunks. See
+	 * writeCollapsed().
+	 *
+	 * @param resource $stream
+	 * @param array $options Rendering options, as for renderFlameGraph()
+	 * @return bool False if writing to the stream failed
+	 */
+	function writeFlameGraph( $stream, array $options = [] ) {
+	}
+
+	/**
+	 * Write the log in flamegraph.pl collapsed format to a stream. The output
+	 * is written in chunks as it is produced, so unlike formatCollapsed(),
+	 * the memory usage does not depend on the size of the output.
+	 *
+	 * @param resource $stream
+	 * @param array $options Pruning options, as for formatCollapsed()
+	 * @return bool False if writing to the stream failed
+	 */
+	function writeCollapsed( $stream, array $options = [] ) {
+	}
+
+	/**
+	 * Write the output of formatSpeedscope() to a stream in chunks. See
+	 * writeCollapsed().
+	 *
+	 * @param resource $stream
+	 * @return bool False if writing to the stream failed
+	 */
+	function writeSpeedscope( $stream ) {
+	}
+
+	/**
+	 * Write the output of formatPprof() to a stream in chunks. See
+	 * writeCollapsed().
+	 *
+	 * @param resource $stream
+	 * @return bool False if writing to the stream failed
+	 */
+	function writePprof( $stream ) {
+	}
+
+	/**
+	 * Write the output of formatCallgrind() to a stream in chunks. See
+	 * writeCollapsed().
+	 *
+	 * @param resource $stream
+	 * @return bool False if writing to the stream failed
+	 */
+	function writeCallgrind( $stream ) {
+	}
+
+	/**
+	 * Write the output of formatChromeTrace() to a stream in chunks. See
+	 * writeCollapsed().
+	 *
+	 * @param resource $stream
+	 * @return bool False if writing to the stream failed
+	 */
+	function writeChromeTrace( $stream ) {
+	}
+
+	/**
+	 * Write the output of formatSpeedscopeEvented() to a stream in chunks.
+	 * See writeCollapsed().
+	 *
+	 * @param resource $stream
+	 * @return bool False if writing to the stream failed
+	 */
+	function writeSpeedscopeEvented( $stream ) {
+	}
+
+	/**
+	 * Write the output of formatGeckoProfile() to a stream in chunks. See
+	 * writeCollapsed().
+	 *
+	 * @param resource $stream
+	 * @return bool False if writing to the stream failed
+	 */
+	function writeGeckoProfile( $stream ) {
+	}
+
+	/**
+	 * Get a view of the entries with timestamps in the range [$start, $end),
+	 * in the units of ExcimerLogEntry::getTimestamp(). The view shares the
+	 * data of this log without copying it, and supports all the same methods,
+	 * so for example a flame graph can be made for part of a request.
+	 *
+	 * The view contains the entries which were present when it was created.
+	 * If this log is a ring buffer, entries which are later overwritten are
+	 * removed from the view, and ExcimerLogEntry objects taken from the view
+	 * for those entries throw a RuntimeException.
+	 *
+	 * Samples aggregated by ExcimerProfiler::setAggregateMode() have no
+	 * timestamp, so a log which is in aggregate mode or contains aggregated
+	 * samples cannot be sliced. In that case, a warning is raised and null is
+	 * returned.
+	 *
+	 * @param float $start
+	 * @param float $end
+	 * @return ExcimerLog|null
+	 */
+	function slice( $start, $end ) {
+	}
+
+	/**
+	 * Compare this log with a baseline log, for example a profile of the
+	 * same request before a deploy. Stacks and functions are matched by name.
+	 *
+	 * Options are:
+	 *   - format: Either "collapsed" (the default) or "functions".
+	 *   - normalize: If true (the default), the baseline counts are scaled
+	 *     by the ratio of getEventCount() of the two logs, so that profiles
+	 *     with different durations can be compared.
+	 *
+	 * With the "collapsed" format, the result is a string in the
+	 * differential collapsed format accepted by difffolded.pl and
+	 * flamegraph.pl: each line has a stack as in formatCollapsed(),
+	 * followed by the baseline count and the count in this log.
+	 *
+	 * With the "functions" format, the result is an array keyed by function
+	 * name, with the elements of aggregateByFunction() and also:
+	 *
+	 *   - baseline_self: The self count in the baseline.
+	 *   - baseline_inclusive: The inclusive count in the baseline.
+	 *   - self_delta: The self count minus the scaled baseline self count.
+	 *   - inclusive_delta: The inclusive count minus the scaled baseline
+	 *     inclusive count.
+	 *
+	 * The array is sorted in descending order of inclusive_delta, so the
+	 * largest regressions come first.
+	 *
+	 * @param ExcimerLog $baseline
+	 * @param array $options
+	 * @return string|array
+	 */
+	function diff( $baseline, array $options = [] ) {
 	}
 
 	/**
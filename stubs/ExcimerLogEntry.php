@@ -1,5 +1,10 @@
 <?php
 
+/**
+ * A sample in an ExcimerLog. If the entry is later removed from the log,
+ * because it was overwritten in a ring buffer or the ring buffer capacity
+ * was reduced, its methods throw a RuntimeException.
+ */
 class ExcimerLogEntry {
 	/**
 	 * ExcimerLogEntry is not constructible by user code.
@@ -16,9 +21,33 @@ class ExcimerLogEntry {
 	public function getTimestamp() {
 	}
 
+	/**
+	 * Get the time of the last sample merged into this entry, in the same
+	 * units as getTimestamp(). If run-length encoding is disabled, or only
+	 * one sample was recorded, this is the same as getTimestamp().
+	 *
+	 * @return float
+	 */
+	public function getEndTimestamp() {
+	}
+
+	/**
+	 * Get the number of consecutive samples with the same stack trace which
+	 * were merged into this entry. This is always 1 unless run-length
+	 * encoding was enabled with ExcimerProfiler::setRunLengthEncoding().
+	 *
+	 * The samples were taken at getTimestamp(), getEndTimestamp(), and at
+	 * approximately evenly spaced times in between.
+	 *
+	 * @return int
+	 */
+	public function getSampleCount() {
+	}
+
 	/**
 	 * Get the event count represented by this log entry. This will typically
 	 * be 1. If there were overruns, it will be 1 plus the number of overruns.
+	 * If samples were merged, it is the sum of their event counts.
 	 *
 	 * @return int
 	 */
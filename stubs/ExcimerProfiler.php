@@ -45,6 +45,86 @@ class ExcimerProfiler {
 	public function setMaxDepth( $maxDepth ) {
 	}
 
+	/**
+	 * Preallocate storage in the log for the given number of samples and
+	 * unique stack frames. This is only a hint: the log will still grow if
+	 * more samples are collected.
+	 *
+	 * The reservation also applies to the new log which is created when
+	 * the log is flushed, so it is typically set to the maximum number of
+	 * samples passed to setFlushCallback().
+	 *
+	 * This will take effect immediately.
+	 *
+	 * @param int $samples
+	 * @param int $frames
+	 */
+	public function reserve( $samples, $frames ) {
+	}
+
+	/**
+	 * Make the log a ring buffer with the specified capacity. Once the log
+	 * contains this many entries, each new sample overwrites the oldest
+	 * entry, so the log holds the most recent samples in constant memory.
+	 * Iteration, getEventCount() and the formatting methods of ExcimerLog
+	 * only see the entries which are still held.
+	 *
+	 * If the log already contains more entries than the capacity, the
+	 * oldest entries are discarded. If this is called with a capacity of
+	 * zero, the limit is removed and the log grows without bound, which is
+	 * the default.
+	 *
+	 * A flush callback is called when the log contains the specified number
+	 * of samples, so with a ring buffer, its sample count should not be
+	 * larger than the capacity.
+	 *
+	 * This will take effect immediately, and also applies to the new log
+	 * created when the log is flushed.
+	 *
+	 * @param int $capacity
+	 */
+	public function setRingBuffer( $capacity ) {
+	}
+
+	/**
+	 * Enable or disable aggregate mode. In aggregate mode, samples are not
+	 * stored individually with a timestamp. Instead, the log keeps an event
+	 * count for each unique stack, so memory usage is proportional to the
+	 * number of unique stacks rather than the number of samples.
+	 *
+	 * Aggregated samples are included in the output of
+	 * ExcimerLog::formatCollapsed(), ExcimerLog::aggregateByFunction(),
+	 * ExcimerLog::getSpeedscopeData() and ExcimerLog::getEventCount(), but
+	 * they are not visible as ExcimerLogEntry objects, and are not included
+	 * in count().
+	 *
+	 * Samples already in the log are kept. This will take effect
+	 * immediately, and also applies to the new log created when the log is
+	 * flushed.
+	 *
+	 * @param bool $aggregate
+	 */
+	public function setAggregateMode( $aggregate ) {
+	}
+
+	/**
+	 * Enable or disable run-length encoding. When enabled, a sample with the
+	 * same stack trace as the previous log entry, taken without a gap since
+	 * that entry, is merged into it. The merged entry has a start and end
+	 * timestamp, a sample count and the summed event count.
+	 *
+	 * This greatly reduces memory usage when a request spends a long time in
+	 * a single call, such as a database query. count() and iteration see one
+	 * entry per run of samples.
+	 *
+	 * This will take effect immediately, and also applies to the new log
+	 * created when the log is flushed.
+	 *
+	 * @param bool $enable
+	 */
+	public function setRunLengthEncoding( $enable ) {
+	}
+
 	/**
 	 * Set a callback which will be called once the specified number of samples
 	 * has been collected.
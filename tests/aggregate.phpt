@@ -0,0 +1,41 @@
+--TEST--
+ExcimerProfiler::setAggregateMode
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setAggregateMode(true);
+$profiler->start();
+while ($profiler->getLog()->getEventCount() < 50) {
+	foo();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+echo "count: " . count($log) . "\n";
+
+$total = 0;
+foreach (explode("\n", trim($log->formatCollapsed())) as $line) {
+	$total += (int)substr($line, strrpos($line, ' ') + 1);
+}
+echo $total === $log->getEventCount() ? "OK\n" : "FAILED\n";
+
+$funcs = $log->aggregateByFunction();
+echo isset($funcs['foo']) && $funcs['foo']['inclusive'] > 0 ? "OK\n" : "FAILED\n";
+
+$speedscope = $log->getSpeedscopeData();
+echo count($speedscope['profiles'][0]['samples']) > 0 ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+count: 0
+OK
+OK
+OK
@@ -0,0 +1,46 @@
+--TEST--
+ExcimerLog::aggregateByLine
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo($depth) {
+	if ($depth) {
+		foo($depth - 1);
+	} else {
+		usleep(1000);
+	}
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	foo(3);
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+$lines = $log->aggregateByLine();
+$file = __FILE__;
+
+// The recursive call line appears several times in each stack, but is
+// counted once
+$call = $lines["$file:5"] ?? null;
+echo $call && $call['file'] === $file && $call['line'] === 5 ? "OK\n" : "FAILED\n";
+echo $call && $call['inclusive'] > 0 && $call['inclusive'] <= $log->getEventCount() ? "OK\n" : "FAILED\n";
+
+// Almost all of the time is spent in usleep()
+$sleep = $lines["$file:7"] ?? null;
+echo $sleep && $sleep['self'] > 0 && $sleep['self'] === $sleep['inclusive'] ? "OK\n" : "FAILED\n";
+
+$self = array_sum(array_column($lines, 'self'));
+echo $self === $log->getEventCount() ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
+OK
+OK
@@ -0,0 +1,73 @@
+--TEST--
+ExcimerLog::diff
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+function bar() {
+	usleep(1000);
+}
+
+function profile($callback) {
+	$profiler = new ExcimerProfiler;
+	$profiler->setEventType(EXCIMER_REAL);
+	$profiler->setPeriod(0.001);
+	$profiler->start();
+	while (count($profiler->getLog()) < 20) {
+		$callback();
+	}
+	$profiler->stop();
+	return $profiler->flush();
+}
+
+$baseline = profile(function () {
+	foo();
+});
+$log = profile(function () {
+	foo();
+	bar();
+});
+
+// The columns of the collapsed diff sum to the event counts
+$diff = $log->diff($baseline, ['normalize' => false]);
+$baselineCount = $count = 0;
+foreach (explode("\n", trim($diff)) as $line) {
+	$parts = explode(' ', $line);
+	$count += (int)array_pop($parts);
+	$baselineCount += (int)array_pop($parts);
+}
+echo $baselineCount === $baseline->getEventCount() && $count === $log->getEventCount()
+	? "OK\n" : "FAILED\n";
+
+// bar() is new, so all of it is a regression
+$functions = $log->diff($baseline, ['format' => 'functions', 'normalize' => false]);
+$aggr = $baseline->aggregateByFunction();
+echo isset($functions['bar']) && $functions['bar']['baseline_inclusive'] === 0
+	&& $functions['bar']['inclusive_delta'] == $functions['bar']['inclusive']
+	? "OK\n" : "FAILED\n";
+echo $functions['foo']['baseline_inclusive'] === $aggr['foo']['inclusive'] ? "OK\n" : "FAILED\n";
+
+// A log compared with itself has no differences
+$ok = true;
+foreach ($log->diff($log, ['format' => 'functions']) as $info) {
+	if ($info['self_delta'] != 0 || $info['inclusive_delta'] != 0) {
+		$ok = false;
+	}
+}
+echo $ok ? "OK\n" : "FAILED\n";
+
+var_dump($log->diff($baseline, ['format' => 'invalid']));
+
+--EXPECTF--
+OK
+OK
+OK
+OK
+
+Warning: ExcimerLog::diff(): Invalid diff format in %s on line %d
+NULL
@@ -0,0 +1,50 @@
+--TEST--
+ExcimerLog::formatCallgrind
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+function bar() {
+	foo();
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	bar();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+$callgrind = $log->formatCallgrind();
+echo strpos($callgrind, "# callgrind format\n") === 0 ? "OK\n" : "FAILED\n";
+echo preg_match('/^fn=\(\d+\) bar$/m', $callgrind) ? "OK\n" : "FAILED\n";
+echo preg_match('/^cfn=\(\d+\) foo\ncalls=\d+ \d+\n8 \d+ \d+$/m', $callgrind) ? "OK\n" : "FAILED\n";
+
+// The self costs of all functions add up to the total event count
+$total = 0;
+$inCall = false;
+foreach (explode("\n", $callgrind) as $line) {
+	if (preg_match('/^calls=/', $line)) {
+		$inCall = true;
+	} elseif (preg_match('/^(\d+) (\d+) \d+$/', $line, $m)) {
+		if (!$inCall) {
+			$total += $m[2];
+		}
+		$inCall = false;
+	}
+}
+echo $total === $log->getEventCount() ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
+OK
+OK
@@ -0,0 +1,41 @@
+--TEST--
+ExcimerLog::formatPprof
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	foo();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+$pprof = $log->formatPprof();
+if (substr($pprof, 0, 2) === "\x1f\x8b") {
+	if (!function_exists('gzdecode')) {
+		echo "OK\nOK\nOK\n";
+		exit;
+	}
+	$pprof = gzdecode($pprof);
+}
+// The first field is the empty string at the start of the string table
+echo substr($pprof, 0, 2) === "\x32\x00" ? "OK\n" : "FAILED\n";
+echo strpos($pprof, "\x03foo") !== false && strpos($pprof, "nanoseconds") !== false
+	? "OK\n" : "FAILED\n";
+// The first sample type is the event count
+echo strpos($pprof, "\x32\x06events") !== false && strpos($pprof, "samples") === false
+	? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
+OK
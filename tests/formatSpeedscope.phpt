@@ -0,0 +1,33 @@
+--TEST--
+ExcimerLog::formatSpeedscope
+--SKIPIF--
+<?php if (!extension_loaded("excimer") || !function_exists('json_decode')) print "skip"; ?>
+--FILE--
+<?php
+
+namespace Foo;
+
+class Bar {
+	public static function baz() {
+		usleep(1000);
+	}
+}
+
+$profiler = new \ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	Bar::baz();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+$json = $log->formatSpeedscope();
+$decoded = json_decode($json, true);
+echo $decoded === $log->getSpeedscopeData() ? "OK\n" : "FAILED\n";
+echo strpos($json, 'Foo\\\\Bar::baz') !== false ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
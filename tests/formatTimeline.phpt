@@ -0,0 +1,72 @@
+--TEST--
+ExcimerLog::formatChromeTrace, formatSpeedscopeEvented and formatGeckoProfile
+--SKIPIF--
+<?php if (!extension_loaded("excimer") || !function_exists('json_decode')) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+function bar() {
+	foo();
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	bar();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+$trace = json_decode($log->formatChromeTrace(), true);
+$depth = 0;
+$ok = true;
+$lastTs = 0;
+foreach ($trace['traceEvents'] as $event) {
+	$depth += $event['ph'] === 'B' ? 1 : -1;
+	if ($depth < 0 || $event['ts'] < $lastTs) {
+		$ok = false;
+	}
+	$lastTs = $event['ts'];
+}
+echo $ok && $depth === 0 ? "OK\n" : "FAILED\n";
+echo in_array('bar', array_column($trace['traceEvents'], 'name')) ? "OK\n" : "FAILED\n";
+
+// Close events match the open frame, and times do not go backwards
+$evented = json_decode($log->formatSpeedscopeEvented(), true);
+$profile = $evented['profiles'][0];
+$open = [];
+$ok = $profile['type'] === 'evented';
+$lastAt = $profile['startValue'];
+foreach ($profile['events'] as $event) {
+	if ($event['type'] === 'O') {
+		$open[] = $event['frame'];
+	} elseif (array_pop($open) !== $event['frame']) {
+		$ok = false;
+	}
+	if ($event['at'] < $lastAt) {
+		$ok = false;
+	}
+	$lastAt = $event['at'];
+}
+echo $ok && !$open && $lastAt === $profile['endValue'] ? "OK\n" : "FAILED\n";
+echo in_array('foo', array_column($evented['shared']['frames'], 'name')) ? "OK\n" : "FAILED\n";
+
+$gecko = json_decode($log->formatGeckoProfile(), true);
+$thread = $gecko['threads'][0];
+echo count($thread['samples']['data']) === count($log) ? "OK\n" : "FAILED\n";
+$strings = implode("\n", $thread['stringTable']);
+echo strpos($strings, 'foo (') !== false ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
+OK
+OK
+OK
+OK
@@ -0,0 +1,56 @@
+--TEST--
+ExcimerLog::getCallTree
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+function bar() {
+	foo();
+	foo();
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	bar();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+function check($node) {
+	$sum = $node['self'];
+	foreach ($node['children'] as $child) {
+		if (!check($child)) {
+			return false;
+		}
+		$sum += $child['inclusive'];
+	}
+	return $sum === $node['inclusive'];
+}
+
+$tree = $log->getCallTree();
+echo $tree['inclusive'] === $log->getEventCount() ? "OK\n" : "FAILED\n";
+echo check($tree) ? "OK\n" : "FAILED\n";
+
+// Both calls to foo() from bar() are merged into one node
+$main = reset($tree['children']);
+$bar = $main['children']['bar'] ?? null;
+echo $bar && $bar['function'] === 'bar' && count($bar['children']) === 1
+	&& isset($bar['children']['foo']) ? "OK\n" : "FAILED\n";
+
+// With a minimum weight above the total, only the pruned node remains
+$tree = $log->getCallTree(['minWeight' => $log->getEventCount() + 1]);
+echo array_keys($tree['children']) === ['excimer_pruned'] && check($tree) ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
+OK
+OK
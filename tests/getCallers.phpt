@@ -0,0 +1,66 @@
+--TEST--
+ExcimerLog::getCallers, getCallees and getBottomUpTree
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+function bar() {
+	foo();
+	foo();
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	bar();
+}
+$profiler->stop();
+$log = $profiler->flush();
+$aggr = $log->aggregateByFunction();
+
+// foo() is only called by bar(), so all of its events are via bar()
+$callers = $log->getCallers('foo');
+echo isset($aggr['foo']) && $callers === [ 'bar' => $aggr['foo']['inclusive'] ]
+	? "OK\n" : "FAILED\n";
+
+$callees = $log->getCallees('bar');
+echo isset($callees['foo']) && $callees['foo'] <= $aggr['bar']['inclusive']
+	? "OK\n" : "FAILED\n";
+
+echo $log->getCallers('nonexistent') === [] ? "OK\n" : "FAILED\n";
+
+function check($node) {
+	$sum = $node['self'];
+	foreach ($node['children'] as $child) {
+		if (!check($child)) {
+			return false;
+		}
+		$sum += $child['inclusive'];
+	}
+	return $sum === $node['inclusive'];
+}
+
+// The children of the root are the leaf functions, with their self counts
+$tree = $log->getBottomUpTree();
+echo $tree['inclusive'] === $log->getEventCount() && check($tree) ? "OK\n" : "FAILED\n";
+$ok = true;
+foreach ($tree['children'] as $name => $node) {
+	if ( $node['inclusive'] !== $aggr[$name]['self'] ) {
+		$ok = false;
+	}
+}
+echo $ok ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
+OK
+OK
+OK
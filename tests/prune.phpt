@@ -0,0 +1,73 @@
+--TEST--
+ExcimerLog pruning options
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+function bar() {
+	usleep(1000);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 40) {
+	foo();
+	bar();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+function collapsedTotal($collapsed) {
+	$total = 0;
+	foreach (explode("\n", trim($collapsed)) as $line) {
+		$total += (int)substr($line, strrpos($line, ' ') + 1);
+	}
+	return $total;
+}
+
+// Neither foo nor bar has all of the samples, so with minFraction=1 they are
+// both pruned, and their weight is moved to the synthetic frame
+$collapsed = $log->formatCollapsed(['minFraction' => 1]);
+echo strpos($collapsed, 'foo') === false && strpos($collapsed, 'bar') === false
+	? "OK\n" : "FAILED\n";
+echo preg_match('/;excimer_pruned \d+$/m', $collapsed) ? "OK\n" : "FAILED\n";
+echo collapsedTotal($collapsed) === $log->getEventCount() ? "OK\n" : "FAILED\n";
+
+// Without options, nothing is pruned
+$collapsed = $log->formatCollapsed();
+echo strpos($collapsed, 'excimer_pruned') === false ? "OK\n" : "FAILED\n";
+
+// A byte limit prunes as much as necessary
+$limited = $log->formatCollapsed(['maxBytes' => 50]);
+echo strlen($limited) <= 50 && strlen($limited) < strlen($collapsed) ? "OK\n" : "FAILED\n";
+echo collapsedTotal($limited) === $log->getEventCount() ? "OK\n" : "FAILED\n";
+echo $log->formatCollapsed(['maxBytes' => strlen($collapsed)]) === $collapsed ? "OK\n" : "FAILED\n";
+
+$funcs = $log->aggregateByFunction(['minFraction' => 1]);
+echo !isset($funcs['foo']) && !isset($funcs['bar'])
+	&& $funcs['excimer_pruned']['self'] > 0 ? "OK\n" : "FAILED\n";
+
+$speedscope = $log->getSpeedscopeData(['minFraction' => 1]);
+$frames = $speedscope['shared']['frames'];
+echo $frames[count($frames) - 1]['name'] === 'excimer_pruned' ? "OK\n" : "FAILED\n";
+echo array_sum($speedscope['profiles'][0]['weights']) === $log->getEventCount() * 1000000
+	? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
+OK
+OK
+OK
+OK
+OK
+OK
+OK
+OK
@@ -0,0 +1,43 @@
+--TEST--
+ExcimerLogEntry after its entry is removed from the log
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	foo();
+}
+$profiler->stop();
+
+$log = $profiler->getLog();
+$n = count($log);
+$first = $log[0];
+$last = $log[$n - 1];
+$lastTimestamp = $last->getTimestamp();
+
+// Shrinking the ring buffer removes all but the newest entries
+$profiler->setRingBuffer(5);
+try {
+	$first->getTimestamp();
+	echo "FAILED\n";
+} catch (RuntimeException $e) {
+	echo $e->getMessage() . "\n";
+}
+
+// A surviving entry still refers to the same sample
+echo $last->getTimestamp() === $lastTimestamp ? "OK\n" : "FAILED\n";
+echo $log[4]->getTimestamp() === $lastTimestamp ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+The log entry has been removed from the log
+OK
+OK
@@ -0,0 +1,48 @@
+--TEST--
+ExcimerLog::renderFlameGraph
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+function bar() {
+	foo();
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	bar();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+$svg = $log->renderFlameGraph(['width' => 800, 'title' => 'Test <graph>']);
+$xml = simplexml_load_string($svg);
+echo $xml ? "OK\n" : "FAILED\n";
+echo (string)$xml['width'] === '800' ? "OK\n" : "FAILED\n";
+echo strpos($svg, 'Test &lt;graph&gt;') !== false ? "OK\n" : "FAILED\n";
+echo preg_match('/<title>bar \(\d+ samples, [\d.]+%\)<\/title>/', $svg) ? "OK\n" : "FAILED\n";
+
+// The root frame spans the whole width, less the padding
+echo preg_match('/<title>all \((\d+) samples, 100%\)<\/title><rect x="10" y="[\d.]+" width="780"/', $svg, $m)
+	&& $m[1] == $log->getEventCount() ? "OK\n" : "FAILED\n";
+
+// A minimum width greater than the root width prunes every frame, leaving
+// only the background
+$svg = $log->renderFlameGraph(['minWidth' => 1181]);
+echo substr_count($svg, '<rect') === 1 ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
+OK
+OK
+OK
+OK
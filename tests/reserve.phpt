@@ -0,0 +1,34 @@
+--TEST--
+ExcimerProfiler::reserve
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->reserve(10, 5);
+$profiler->reserve(-1, 5);
+
+for ($i = 0; $i < 2; $i++) {
+	$profiler->start();
+	while (count($profiler->getLog()) < 50) {
+		foo();
+	}
+	$profiler->stop();
+	$log = $profiler->flush();
+	echo count($log) >= 50 ? "OK\n" : "FAILED\n";
+	echo strpos($log->formatCollapsed(), ';foo ') !== false ? "OK\n" : "FAILED\n";
+}
+
+--EXPECTF--
+Warning: ExcimerProfiler::reserve(): Invalid reservation size in %s on line %d
+OK
+OK
+OK
+OK
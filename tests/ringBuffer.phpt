@@ -0,0 +1,76 @@
+--TEST--
+ExcimerProfiler ring buffer
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setRingBuffer(-1);
+$profiler->setRingBuffer(10);
+
+$profiler->start();
+$t = microtime(true);
+while (microtime(true) - $t < 0.2) {
+	foo();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+echo "count: " . count($log) . "\n";
+
+$eventCount = 0;
+$lastTimestamp = -1;
+$ordered = true;
+foreach ($log as $entry) {
+	$eventCount += $entry->getEventCount();
+	if ($entry->getTimestamp() <= $lastTimestamp) {
+		$ordered = false;
+	}
+	$lastTimestamp = $entry->getTimestamp();
+}
+echo "ordered: " . ($ordered ? "OK" : "FAILED") . "\n";
+echo "event count: " . ($eventCount === $log->getEventCount() ? "OK" : "FAILED") . "\n";
+echo "recent: " . ($lastTimestamp > 0.15 ? "OK" : "FAILED") . "\n";
+
+$speedscope = $log->getSpeedscopeData();
+echo "speedscope samples: " . count($speedscope['profiles'][0]['samples']) . "\n";
+
+$collapsedCount = 0;
+foreach (explode("\n", trim($log->formatCollapsed())) as $line) {
+	$collapsedCount += (int)substr($line, strrpos($line, ' ') + 1);
+}
+echo "collapsed: " . ($collapsedCount === $log->getEventCount() ? "OK" : "FAILED") . "\n";
+
+// The new log is also a ring buffer
+$profiler->start();
+$t = microtime(true);
+while (microtime(true) - $t < 0.1) {
+	foo();
+}
+$profiler->stop();
+echo "rotated count: " . count($profiler->getLog()) . "\n";
+
+// Shrinking keeps the most recent entries
+$profiler->setRingBuffer(5);
+echo "shrunk count: " . count($profiler->getLog()) . "\n";
+$profiler->setRingBuffer(0);
+echo "unlimited count: " . count($profiler->getLog()) . "\n";
+
+--EXPECTF--
+Warning: ExcimerProfiler::setRingBuffer(): Invalid ring buffer capacity in %s on line %d
+count: 10
+ordered: OK
+event count: OK
+recent: OK
+speedscope samples: 10
+collapsed: OK
+rotated count: 10
+shrunk count: 5
+unlimited count: 5
@@ -0,0 +1,44 @@
+--TEST--
+ExcimerProfiler::setRunLengthEncoding
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setRunLengthEncoding(true);
+$profiler->start();
+while ($profiler->getLog()->getEventCount() < 20) {
+	foo();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+$events = 0;
+$samples = 0;
+$merged = false;
+foreach ($log as $entry) {
+	$events += $entry->getEventCount();
+	$samples += $entry->getSampleCount();
+	if ($entry->getSampleCount() > 1
+		&& $entry->getEndTimestamp() > $entry->getTimestamp())
+	{
+		$merged = true;
+	}
+}
+echo $merged ? "OK\n" : "FAILED\n";
+echo $events === $log->getEventCount() ? "OK\n" : "FAILED\n";
+echo $samples > count($log) ? "OK\n" : "FAILED\n";
+echo strpos($log->formatCollapsed(), ';foo ') !== false ? "OK\n" : "FAILED\n";
+
+--EXPECT--
+OK
+OK
+OK
+OK
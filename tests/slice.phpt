@@ -0,0 +1,94 @@
+--TEST--
+ExcimerLog::slice
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+function sum($log) {
+	$eventCount = 0;
+	foreach ($log as $entry) {
+		$eventCount += $entry->getEventCount();
+	}
+	return $eventCount;
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	foo();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+$mid = $log[10]->getTimestamp();
+$first = $log->slice(0, $mid);
+$second = $log->slice($mid, INF);
+echo count($first) === 10 && count($second) === count($log) - 10 ? "OK\n" : "FAILED\n";
+echo $second[0]->getTimestamp() === $mid ? "OK\n" : "FAILED\n";
+echo $first->getEventCount() + $second->getEventCount() === $log->getEventCount()
+	&& sum($first) === $first->getEventCount() ? "OK\n" : "FAILED\n";
+
+// Exporters work on a view
+$collapsedCount = 0;
+foreach (explode("\n", trim($second->formatCollapsed())) as $line) {
+	$collapsedCount += (int)substr($line, strrpos($line, ' ') + 1);
+}
+echo $collapsedCount === $second->getEventCount() ? "OK\n" : "FAILED\n";
+
+// A slice of a slice, which outlives the original log
+$inner = $second->slice($mid, $log[12]->getTimestamp());
+unset($log, $first, $second);
+echo count($inner) === 2 && $inner[1]->getTimestamp() > $mid ? "OK\n" : "FAILED\n";
+
+echo count($inner->slice(1, 0)) === 0 ? "OK\n" : "FAILED\n";
+
+// A view of a ring buffer loses entries as they are overwritten
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->setRingBuffer(10);
+$profiler->start();
+while (count($profiler->getLog()) < 10) {
+	foo();
+}
+$view = $profiler->getLog()->slice(0, INF);
+$n = count($view);
+$entry = $view[0];
+$t = microtime(true);
+while (microtime(true) - $t < 0.05) {
+	foo();
+}
+$profiler->stop();
+echo $n === 10 && count($view) < 10 && sum($view) === $view->getEventCount()
+	? "OK\n" : "FAILED\n";
+try {
+	$entry->getTimestamp();
+	echo "FAILED\n";
+} catch (RuntimeException $e) {
+	echo $e->getMessage() . "\n";
+}
+
+// Aggregated samples have no timestamps, so cannot be sliced
+$profiler = new ExcimerProfiler;
+$profiler->setAggregateMode(true);
+var_dump($profiler->getLog()->slice(0, INF));
+
+--EXPECTF--
+OK
+OK
+OK
+OK
+OK
+OK
+OK
+The log entry has been removed from the log
+
+Warning: ExcimerLog::slice(): Cannot slice a log with aggregated samples in %s on line %d
+NULL
@@ -0,0 +1,67 @@
+--TEST--
+ExcimerLog::write* stream output
+--SKIPIF--
+<?php if (!extension_loaded("excimer")) print "skip"; ?>
+--FILE--
+<?php
+
+function foo() {
+	usleep(1000);
+}
+
+$profiler = new ExcimerProfiler;
+$profiler->setEventType(EXCIMER_REAL);
+$profiler->setPeriod(0.001);
+$profiler->start();
+while (count($profiler->getLog()) < 20) {
+	foo();
+}
+$profiler->stop();
+$log = $profiler->flush();
+
+function written($log, $method) {
+	$stream = fopen('php://memory', 'w+');
+	$result = $log->$method($stream);
+	rewind($stream);
+	$data = stream_get_contents($stream);
+	fclose($stream);
+	return $result ? $data : false;
+}
+
+$methods = [
+	'Collapsed',
+	'Speedscope',
+	'Callgrind',
+	'ChromeTrace',
+	'SpeedscopeEvented',
+];
+foreach ($methods as $method) {
+	$expected = $log->{"format$method"}();
+	echo "$method: " . (written($log, "write$method") === $expected ? "OK" : "FAILED") . "\n";
+}
+
+$stream = fopen('php://memory', 'w+');
+$options = ['width' => 600, 'title' => 'Stream test'];
+$result = $log->writeFlameGraph($stream, $options);
+rewind($stream);
+echo "FlameGraph: " . ($result && stream_get_contents($stream) === $log->renderFlameGraph($options)
+	? "OK" : "FAILED") . "\n";
+fclose($stream);
+echo "FlameGraph default: " . (written($log, 'writeFlameGraph') === $log->renderFlameGraph() ? "OK" : "FAILED") . "\n";
+
+// These contain the current time, so just check they are not empty
+foreach (['Pprof', 'GeckoProfile'] as $method) {
+	$data = written($log, "write$method");
+	echo "$method: " . (is_string($data) && strlen($data) ? "OK" : "FAILED") . "\n";
+}
+
+--EXPECT--
+Collapsed: OK
+Speedscope: OK
+Callgrind: OK
+ChromeTrace: OK
+SpeedscopeEvented: OK
+FlameGraph: OK
+FlameGraph default: OK
+Pprof: OK
+GeckoProfile: OK